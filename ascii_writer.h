@@ -0,0 +1,103 @@
+/**
+ * @brief Gathered output for rendered frames
+ *
+ * Rows are assembled into caller-owned buffers and handed over as spans; the
+ * whole frame then goes out through as few writev calls as the kernel allows
+ * instead of a stream flush per row.
+ */
+
+#ifndef ASCII_WRITER_H
+#define ASCII_WRITER_H
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#ifndef IOV_MAX
+    #define IOV_MAX 1024
+#endif
+
+struct WriteStats {
+    size_t bytes = 0;
+    size_t syscalls = 0;
+};
+
+class AsciiWriter {
+public:
+    explicit AsciiWriter(const std::string& filename)
+        : fd_(::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)), owns_fd_(true) {}
+
+    // Writes to an already open descriptor (stdout, a socket) without closing it.
+    explicit AsciiWriter(int fd) : fd_(fd), owns_fd_(false) {}
+
+    ~AsciiWriter() {
+        flush();
+        if (owns_fd_ && fd_ >= 0) {
+            ::close(fd_);
+        }
+    }
+
+    AsciiWriter(const AsciiWriter&) = delete;
+    AsciiWriter& operator=(const AsciiWriter&) = delete;
+
+    bool is_open() const { return fd_ >= 0; }
+    const WriteStats& stats() const { return stats_; }
+
+    // Queues a span; it is not copied, so it has to outlive the next flush().
+    void add(const char* data, size_t size) {
+        if (size > 0) {
+            pending_.push_back({const_cast<char*>(data), size});
+        }
+    }
+
+    void add(const std::string& data) { add(data.data(), data.size()); }
+    // a temporary would be gone before the flush
+    void add(std::string&&) = delete;
+
+    bool flush() {
+        bool ok = fd_ >= 0;
+        size_t next = 0;
+        while (ok && next < pending_.size()) {
+            int count = static_cast<int>(std::min<size_t>(pending_.size() - next, IOV_MAX));
+            ssize_t written = ::writev(fd_, &pending_[next], count);
+            stats_.syscalls++;
+            if (written < 0) {
+                ok = (errno == EINTR);
+                continue;
+            }
+            // nothing taken with bytes still to go would only spin
+            if (written == 0) {
+                ok = false;
+                continue;
+            }
+            stats_.bytes += static_cast<size_t>(written);
+            // step over what went out, trimming a span the kernel cut short
+            size_t left = static_cast<size_t>(written);
+            while (next < pending_.size() && left >= pending_[next].iov_len) {
+                left -= pending_[next].iov_len;
+                next++;
+            }
+            if (left > 0) {
+                pending_[next].iov_base = static_cast<char*>(pending_[next].iov_base) + left;
+                pending_[next].iov_len -= left;
+            }
+        }
+        pending_.clear();
+        return ok;
+    }
+
+private:
+    int fd_;
+    bool owns_fd_;
+    std::vector<iovec> pending_;
+    WriteStats stats_;
+};
+
+#endif
@@ -0,0 +1,59 @@
+/**
+ * @brief Running row of block accumulators for streaming reduction
+ *
+ * Source rows are added one at a time, left to right; once `scalar` of them
+ * are in, the row of block averages is ready. Only one row of sums is ever
+ * kept, so memory is O(width) no matter how tall the image is.
+ */
+
+#ifndef BLOCK_ROWS_H
+#define BLOCK_ROWS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "scale_kernels.h"
+
+class BlockRowAccumulator {
+public:
+    BlockRowAccumulator(int width, int scalar)
+        : scalar_(scalar), blocks_(width / scalar), rows_(0), sums_(blocks_, 0), averages_(blocks_, 0) {}
+
+    int blocks() const { return blocks_; }
+    const int* averages() const { return averages_.data(); }
+
+    // Adds a row of single-channel luminance. Returns true when it completed a
+    // block row, which averages() then holds until the next completed one.
+    bool add_row(const unsigned char* luma) {
+        return dispatch_block_scale(scalar_, [&](const auto& scale) { return add_scaled_row(scale, luma); });
+    }
+
+private:
+    template <class Scale>
+    bool add_scaled_row(const Scale& scale, const unsigned char* luma) {
+        const unsigned char* block = luma;
+        for (int b = 0; b < blocks_; b++) {
+            sums_[b] += scale.row_sum(block);
+            block += scale.size();
+        }
+        if (++rows_ < scalar_) {
+            return false;
+        }
+
+        for (int b = 0; b < blocks_; b++) {
+            averages_[b] = static_cast<int>(scale.average(sums_[b]));
+            sums_[b] = 0;
+        }
+        rows_ = 0;
+        return true;
+    }
+
+    int scalar_;
+    int blocks_;
+    int rows_;
+    std::vector<uint32_t> sums_;
+    std::vector<int> averages_;
+};
+
+#endif
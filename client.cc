@@ -0,0 +1,353 @@
+/**
+ * @brief Command-line client for the ascii-artd render daemon
+ *
+ * Sends each image to a running `./main --daemon` and prints the rendered
+ * text, so callers pay for a socket round trip instead of a process start
+ * and a cold decoder. With --raw it streams decoded frames from stdin through
+ * shared memory instead, several in flight at once.
+ */
+
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <csignal>
+
+#include <unistd.h>
+
+#include "ascii_writer.h"
+#include "mapped_file.h"
+#include "render_protocol.h"
+#include "scale_kernels.h"
+#include "shared_frames.h"
+
+using namespace std;
+
+struct ClientOptions {
+    vector<string> inputs;
+    string socket_path = render_default_socket;
+    string output;
+    RenderRequest request;
+    bool send_inline = false;
+    SharedFrame raw;      // frame shape for --raw, width 0 when not streaming
+    size_t slots = 4;
+};
+
+void print_usage(const char * program) {
+    cout << "Usage: " << program << " [options] image..." << endl
+         << "       " << program << " [options] -        (image bytes on stdin)" << endl
+         << endl
+         << "  -S, --socket PATH     daemon socket (default " << render_default_socket << ")" << endl
+         << "  -s, --scale N         downscaling factor (default: the daemon's)" << endl
+         << "  -p, --palette CHARS   glyphs from darkest to brightest (default: the daemon's)" << endl
+         << "  -f, --format F        input format, as for ./main (default auto)" << endl
+         << "  -l, --luma-model M    mean, rec601, rec709 or linear (default: the daemon's)" << endl
+         << "  -i, --inline          send the image bytes rather than the path, for daemons" << endl
+         << "                        that cannot see the file" << endl
+         << "  -o, --output FILE     write the text here instead of stdout" << endl
+         << "      --output-format F what the daemon answers with; only text, the rows of" << endl
+         << "                        doubled glyphs, for now (default text)" << endl
+         << "      --raw WxHxC       read raw frames from stdin instead of images: C is 1 (luma)," << endl
+         << "                        3 (RGB) or 4 (RGBA); they go to the daemon through shared memory" << endl
+         << "      --slots N         frames in flight with --raw (default 4)" << endl
+         << "  -h, --help            show this message" << endl;
+}
+
+// Returns 0 when the options are usable, otherwise the exit code to quit with.
+int parse_options(int argc, char * argv[], ClientOptions & options) {
+    const vector<string> value_options = {"-S", "--socket", "-s", "--scale", "-p", "--palette", "-f", "--format",
+                                          "-l", "--luma-model", "-o", "--output", "--raw", "--slots",
+                                          "--output-format"};
+    bool scale_given = false;
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return -1;
+        } else if (arg == "-i" || arg == "--inline") {
+            options.send_inline = true;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            if (find(value_options.begin(), value_options.end(), arg) == value_options.end()) {
+                cerr << "Unknown option " << arg << endl;
+                return 2;
+            }
+            if (i + 1 >= argc) {
+                cerr << "Missing value for " << arg << endl;
+                return 2;
+            }
+            string value = argv[++i];
+
+            if (arg == "-S" || arg == "--socket") {
+                options.socket_path = value;
+            } else if (arg == "-s" || arg == "--scale") {
+                options.request.scalar = atoi(value.c_str());
+                scale_given = true;
+            } else if (arg == "-p" || arg == "--palette") {
+                options.request.palette = value;
+            } else if (arg == "-f" || arg == "--format") {
+                options.request.format = value;
+            } else if (arg == "-l" || arg == "--luma-model") {
+                options.request.model = value;
+            } else if (arg == "--output-format") {
+                options.request.output = value;
+            } else if (arg == "--raw") {
+                SharedFrame & raw = options.raw;
+                char tail = '\0';
+                if (sscanf(value.c_str(), "%dx%dx%d%c", &raw.width, &raw.height, &raw.channels, &tail) != 3 || 
+                    raw.width <= 0 || raw.height <= 0 || (raw.channels != 1 && raw.channels != 3 && raw.channels != 4)) {
+                    cerr << "--raw wants WIDTHxHEIGHTxCHANNELS, with 1, 3 or 4 channels" << endl;
+                    return 2;
+                }
+                raw.stride = static_cast<size_t>(raw.width) * raw.channels;
+            } else if (arg == "--slots") {
+                options.slots = static_cast<size_t>(max(atoi(value.c_str()), 1));
+            } else {
+                options.output = value;
+            }
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+
+    if (options.inputs.empty() && options.raw.width == 0) {
+        cerr << "No input images" << endl;
+        return 2;
+    }
+    if (options.request.scalar < 0 || (options.request.scalar == 0 && scale_given)) {
+        cerr << "Scale must be at least 1" << endl;
+        return 2;
+    }
+    if (options.request.scalar > max_block_scale) {
+        cerr << "Scale must be at most " << max_block_scale << endl;
+        return 2;
+    }
+    // the daemon drops a connection whose palette is longer than that
+    if (!options.request.palette.empty() && (options.request.palette.length() < 2 || options.request.palette.length() > 256)) {
+        cerr << "Palette needs between 2 and 256 characters" << endl;
+        return 2;
+    }
+    return 0;
+}
+
+bool read_stdin(string & data) {
+    char buffer[65536];
+    for (;;) {
+        ssize_t got = read(0, buffer, sizeof(buffer));
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return got == 0;
+        }
+        data.append(buffer, static_cast<size_t>(got));
+    }
+}
+
+// Fills in where the image comes from: stdin and --inline send bytes, anything
+// else goes as an absolute path, since the daemon has its own working directory.
+bool set_source(const ClientOptions & options, const string & input, RenderRequest & request) {
+    request.path.clear();
+    request.data.clear();
+    if (input == "-") {
+        return read_stdin(request.data);
+    }
+    if (options.send_inline) {
+        MappedFile file;
+        if (!file.open(input)) {
+            return false;
+        }
+        request.data.assign(reinterpret_cast<const char *>(file.data()), file.size());
+        return true;
+    }
+    char resolved[PATH_MAX];
+    if (realpath(input.c_str(), resolved) == nullptr) {
+        return false;
+    }
+    request.path = resolved;
+    return true;
+}
+
+// Reads exactly size bytes; false at end of input, with a warning for a torn frame.
+bool read_frame(unsigned char * frame, size_t size) {
+    size_t have = 0;
+    while (have < size) {
+        ssize_t got = read(0, frame + have, size - have);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            if (have > 0) {
+                cerr << "Ignoring a partial frame at the end of input" << endl;
+            }
+            return false;
+        }
+        have += static_cast<size_t>(got);
+    }
+    return true;
+}
+
+// After a send fails: a daemon that turns the connection away says why before
+// hanging up, so whatever answer it left is read before giving up.
+void report_lost_connection(const ClientOptions & options, SocketReader & in) {
+    bool ok = false;
+    string body;
+    if (read_render_response(in, ok, body) && !ok) {
+        cerr << options.socket_path << ": " << body << endl;
+    } else {
+        cerr << "Lost connection to " << options.socket_path << endl;
+    }
+}
+
+// Writes out everything queued on out; on failure says why and returns false.
+bool flush_output(const ClientOptions & options, AsciiWriter & out) {
+    if (out.flush()) {
+        return true;
+    }
+    cerr << "Error writing " << (options.output.empty() ? "stdout" : options.output) << ": " << strerror(errno) << endl;
+    return false;
+}
+
+// --raw: frames go into a ring of shared slots and the daemon writes the text
+// back beside them, so only offsets cross the socket. Up to one request per
+// slot is in flight; replies come back in order, and a slot is refilled only
+// after its text has been written out.
+int stream_raw(const ClientOptions & options, int fd, AsciiWriter & out) {
+    const SharedFrame & raw = options.raw;
+    // without -s the daemon picks the scale, so the text slots are sized for 1
+    int scalar = max(options.request.scalar, 1);
+    size_t frame_bytes = raw.stride * raw.height;
+    size_t text_bytes = (2 * static_cast<size_t>(raw.width / scalar) + 1) * (raw.height / scalar);
+
+    SharedFrameRing ring;
+    if (!ring.create(options.slots, frame_bytes, max<size_t>(text_bytes, 1))) {
+        cerr << "Cannot create shared memory: " << strerror(errno) << endl;
+        return 1;
+    }
+    SocketReader in(fd);
+    RenderRequest request = options.request;
+    request.shared_frame = true;
+    request.frame = raw;
+    request.shared_reply = true;
+    request.reply.capacity = ring.text_capacity();
+
+    size_t sent = 0;
+    size_t done = 0;
+    bool more = true;
+    string body;
+    int failed = 0;
+    while (more || done < sent) {
+        while (more && sent - done < ring.slots()) {
+            size_t slot = sent % ring.slots();
+            more = read_frame(ring.frame(slot), frame_bytes);
+            if (!more) {
+                break;
+            }
+            request.memfd = sent == 0 ? ring.fd() : -1;
+            request.frame.offset = ring.frame_offset(slot);
+            request.reply.offset = ring.text_offset(slot);
+            if (!send_render_request(fd, request)) {
+                report_lost_connection(options, in);
+                return 1;
+            }
+            sent++;
+        }
+        if (done == sent) {
+            break;
+        }
+
+        bool ok = false;
+        if (!read_render_response(in, ok, body)) {
+            cerr << "Lost connection to " << options.socket_path << endl;
+            return 1;
+        }
+        if (!ok) {
+            cerr << "frame " << done << ": " << body << endl;
+            failed++;
+        } else {
+            // the reply is the length of the text the daemon left in the slot
+            unsigned long long length = 0;
+            if (!render_parse_numbers(body, &length, 1) || length > ring.text_capacity()) {
+                cerr << "frame " << done << ": malformed reply from " << options.socket_path << endl;
+                return 1;
+            }
+            out.add(ring.text(done % ring.slots()), static_cast<size_t>(length));
+            if (!flush_output(options, out)) {
+                return 1;
+            }
+        }
+        done++;
+    }
+    return failed == 0 ? 0 : 1;
+}
+
+int main(int argc, char * argv[]) {
+    ClientOptions options;
+    int status = parse_options(argc, argv, options);
+    if (status != 0) {
+        return max(status, 0);
+    }
+    // a closed output pipe shows up as a failed write, reported like any other
+    signal(SIGPIPE, SIG_IGN);
+
+    int fd = connect_render_socket(options.socket_path);
+    if (fd < 0) {
+        cerr << "Cannot connect to " << options.socket_path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    unique_ptr<AsciiWriter> out(options.output.empty() ? new AsciiWriter(1) : new AsciiWriter(options.output));
+    if (!out->is_open()) {
+        cerr << "Cannot write " << options.output << endl;
+        close(fd);
+        return 1;
+    }
+    if (options.raw.width > 0) {
+        status = stream_raw(options, fd, *out);
+        close(fd);
+        return status;
+    }
+
+    SocketReader in(fd);
+    RenderRequest request = options.request;
+    string body;
+
+    // every image goes down the one connection, one after another
+    int failed = 0;
+    for (const string & input : options.inputs) {
+        bool ok = false;
+        if (!set_source(options, input, request)) {
+            cerr << input << ": cannot read image" << endl;
+            failed++;
+            continue;
+        }
+        if (!send_render_request(fd, request)) {
+            report_lost_connection(options, in);
+            close(fd);
+            return 1;
+        }
+        if (!read_render_response(in, ok, body)) {
+            cerr << "Lost connection to " << options.socket_path << endl;
+            close(fd);
+            return 1;
+        }
+        if (!ok) {
+            cerr << input << ": " << body << endl;
+            failed++;
+            continue;
+        }
+        out->add(body);
+        if (!flush_output(options, *out)) {
+            close(fd);
+            return 1;
+        }
+    }
+    close(fd);
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+/**
+ * @brief Building blocks for the staged frame player
+ *
+ * Playback runs decode, reduce and present on their own threads joined by
+ * small queues, so one slow frame in a stage overlaps with work on its
+ * neighbours instead of stalling the whole sequence. The queues are bounded;
+ * a stage that gets ahead waits rather than piling up frames, and with them
+ * latency.
+ */
+
+#ifndef FRAME_PIPELINE_H
+#define FRAME_PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// A queue that holds at most capacity items. Closing it wakes everyone: push
+// then fails, and pop fails once the queue is empty.
+template <class T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity) : capacity_(capacity), closed_(false) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_full_.wait(lock, [this] { return closed_ || items_.size() < capacity_; });
+        if (closed_) {
+            return false;
+        }
+        items_.push_back(std::move(item));
+        lock.unlock();
+        not_empty_.notify_one();
+        return true;
+    }
+
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        not_empty_.wait(lock, [this] { return closed_ || !items_.empty(); });
+        if (items_.empty()) {
+            return false;
+        }
+        item = std::move(items_.front());
+        items_.pop_front();
+        lock.unlock();
+        not_full_.notify_one();
+        return true;
+    }
+
+    // Whether another item is already waiting; a late frame is only worth
+    // dropping when something newer is there to take its place.
+    bool ready() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !items_.empty();
+    }
+
+    void close() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            closed_ = true;
+        }
+        not_full_.notify_all();
+        not_empty_.notify_all();
+    }
+
+private:
+    std::deque<T> items_;
+    const size_t capacity_;
+    bool closed_;
+    mutable std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+};
+
+// When frames are due on screen: frame i at origin + i / fps. The origin is
+// fixed by the first frame presented, and until then nothing is late. With
+// fps 0 playback is unpaced and nothing is ever late.
+class FrameClock {
+public:
+    typedef std::chrono::steady_clock::time_point time_point;
+
+    explicit FrameClock(double fps)
+        : period_(fps > 0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                std::chrono::duration<double>(1.0 / fps))
+                          : std::chrono::steady_clock::duration::zero()),
+          started_(false) {}
+
+    bool paced() const { return period_.count() > 0; }
+    std::chrono::steady_clock::duration period() const { return period_; }
+    bool started() const { return started_.load(std::memory_order_acquire); }
+
+    // Only the presenting stage calls this, once, when frame index goes up at now.
+    void start(size_t index, time_point now) {
+        origin_ = now - period_ * static_cast<long long>(index);
+        started_.store(true, std::memory_order_release);
+    }
+
+    time_point due(size_t index) const { return origin_ + period_ * static_cast<long long>(index); }
+
+    // A frame is stale once the one after it is due.
+    bool stale(size_t index, time_point now) const { return paced() && started() && now >= due(index + 1); }
+
+private:
+    const std::chrono::steady_clock::duration period_;
+    time_point origin_;
+    std::atomic<bool> started_;
+};
+
+// Per-stage timings in milliseconds. Each stage records its own from one
+// thread; they are only read once the stages have finished.
+class StageTimes {
+public:
+    void add(double ms) { ms_.push_back(ms); }
+    void add(std::chrono::steady_clock::time_point since) {
+        add(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - since).count());
+    }
+
+    size_t count() const { return ms_.size(); }
+
+    // p in [0, 1]; nearest rank, 0 when nothing was recorded.
+    double percentile(double p) {
+        if (ms_.empty()) {
+            return 0;
+        }
+        size_t rank = std::min(ms_.size() - 1, static_cast<size_t>(p * static_cast<double>(ms_.size())));
+        std::nth_element(ms_.begin(), ms_.begin() + static_cast<std::ptrdiff_t>(rank), ms_.end());
+        return ms_[rank];
+    }
+
+private:
+    std::vector<double> ms_;
+};
+
+#endif
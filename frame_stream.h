@@ -0,0 +1,278 @@
+/**
+ * @brief Video frames read off a pipe: YUV4MPEG2 or fixed-size raw frames
+ *
+ * Lets `ffmpeg ... | ./main --play -` render video without a file per frame.
+ * Frames are read with large reads into a small ring of reused buffers and
+ * handed out as views, so nothing is copied on the way in. For Y4M the view
+ * is the Y plane alone, which is already luminance; the chroma planes are
+ * read past and never converted.
+ */
+
+#ifndef FRAME_STREAM_H
+#define FRAME_STREAM_H
+
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <climits>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include "image_buffer.h"
+
+class FrameStream {
+public:
+    // The last `slots` frames returned by next(view) stay valid. A caller
+    // that reads into its own buffers can ask for none.
+    explicit FrameStream(int fd, size_t slots = 2)
+        : fd_(fd), slots_(slots), next_slot_(0), y4m_(false), fps_(0), frame_bytes_(0), begin_(0), end_(0),
+          stop_(nullptr) {
+        // fewer, larger reads; ignored where the fd is not a pipe or the limit is lower
+        fcntl(fd_, F_SETPIPE_SZ, 1 << 20);
+    }
+
+    FrameStream(const FrameStream&) = delete;
+    FrameStream& operator=(const FrameStream&) = delete;
+
+    // Makes reads give up, as at the end of the stream, once *flag is set. A
+    // stalled pipe is checked on at least every 100 ms, so this works whichever
+    // thread the signal that sets it lands on.
+    void stop_when(const volatile sig_atomic_t* flag) { stop_ = flag; }
+
+    // Headerless frames of width x height x channels (1 gray, 3 RGB, 4 RGBA).
+    bool open_raw(int width, int height, int channels) {
+        if (width <= 0 || height <= 0 || (channels != 1 && channels != 3 && channels != 4) ||
+            static_cast<size_t>(width) * channels > INT_MAX / static_cast<size_t>(height)) {
+            error_ = "Bad raw frame size";
+            return false;
+        }
+        frame_.width = width;
+        frame_.height = height;
+        frame_.channels = channels;
+        frame_.stride = static_cast<ptrdiff_t>(width) * channels;
+        frame_bytes_ = static_cast<size_t>(frame_.stride) * height;
+        return allocate();
+    }
+
+    // Reads the YUV4MPEG2 stream header. 8-bit 4:2:0, 4:2:2, 4:4:4, 4:1:1
+    // and mono are understood.
+    bool open_y4m() {
+        std::string header;
+        if (!read_line(header) || header.compare(0, 10, "YUV4MPEG2 ") != 0) {
+            // stopped before a header came is not a bad stream
+            if (stop_ == nullptr || !*stop_) {
+                error_ = "Not a YUV4MPEG2 stream";
+            }
+            return false;
+        }
+        long width = 0;
+        long height = 0;
+        std::string colorspace = "420jpeg";
+        for (size_t at = 10; at < header.size();) {
+            size_t end = header.find(' ', at);
+            if (end == std::string::npos) {
+                end = header.size();
+            }
+            std::string token = header.substr(at, end - at);
+            if (!token.empty() && token[0] == 'W') {
+                width = strtol(token.c_str() + 1, nullptr, 10);
+            } else if (!token.empty() && token[0] == 'H') {
+                height = strtol(token.c_str() + 1, nullptr, 10);
+            } else if (!token.empty() && token[0] == 'C') {
+                colorspace = token.substr(1);
+            } else if (!token.empty() && token[0] == 'F') {
+                char* colon = nullptr;
+                double numerator = strtod(token.c_str() + 1, &colon);
+                double denominator = *colon == ':' ? strtod(colon + 1, nullptr) : 0;
+                fps_ = denominator > 0 ? numerator / denominator : 0;
+            }
+            at = end + 1;
+        }
+        if (width <= 0 || height <= 0 || width > 65536 || height > 65536) {
+            error_ = "Bad Y4M frame size";
+            return false;
+        }
+
+        size_t w = static_cast<size_t>(width);
+        size_t h = static_cast<size_t>(height);
+        size_t chroma;
+        if (colorspace == "420jpeg" || colorspace == "420paldv" || colorspace == "420mpeg2" || colorspace == "420") {
+            chroma = 2 * ((w + 1) / 2) * ((h + 1) / 2);
+        } else if (colorspace == "422") {
+            chroma = 2 * ((w + 1) / 2) * h;
+        } else if (colorspace == "444") {
+            chroma = 2 * w * h;
+        } else if (colorspace == "444alpha") {
+            chroma = 3 * w * h;
+        } else if (colorspace == "411") {
+            chroma = 2 * ((w + 3) / 4) * h;
+        } else if (colorspace == "mono") {
+            chroma = 0;
+        } else {
+            error_ = "Unsupported Y4M colorspace " + colorspace;
+            return false;
+        }
+        y4m_ = true;
+        frame_.width = static_cast<int>(width);
+        frame_.height = static_cast<int>(height);
+        frame_.channels = 1;
+        frame_.stride = static_cast<ptrdiff_t>(width);
+        frame_bytes_ = w * h + chroma;
+        return allocate();
+    }
+
+    // Reads the next frame into the ring and points view at it. False at the
+    // end of the stream; error() then says whether it ended badly.
+    bool next(ImageView& view) {
+        if (!next(view, ring_[next_slot_].get())) {
+            return false;
+        }
+        next_slot_ = (next_slot_ + 1) % ring_.size();
+        return true;
+    }
+
+    // Reads the next frame into slot, frame_bytes() long, which stays the
+    // caller's to keep for as long as view is in use.
+    bool next(ImageView& view, unsigned char* slot) {
+        if (y4m_) {
+            std::string marker;
+            if (!read_line(marker)) {
+                return false;
+            }
+            if (marker.compare(0, 5, "FRAME") != 0) {
+                error_ = "Missing Y4M FRAME marker";
+                return false;
+            }
+        }
+        if (!read_exact(slot, frame_bytes_)) {
+            return false;
+        }
+        view = frame_;
+        view.pixels = slot;
+        return true;
+    }
+
+    int width() const { return frame_.width; }
+    int height() const { return frame_.height; }
+    // What one frame takes in the stream, headers aside.
+    size_t frame_bytes() const { return frame_bytes_; }
+    // The frame rate a Y4M header gives, or 0.
+    double fps() const { return fps_; }
+    const std::string& error() const { return error_; }
+
+private:
+    bool allocate() {
+        ring_.clear();
+        for (size_t i = 0; i < slots_; i++) {
+            ring_.emplace_back(new (std::nothrow) unsigned char[frame_bytes_]);
+            if (ring_.back() == nullptr) {
+                error_ = "Out of memory";
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Takes what is buffered, then reads the rest straight into out.
+    bool read_exact(unsigned char* out, size_t size) {
+        size_t have = std::min(size, end_ - begin_);
+        memcpy(out, buffer_ + begin_, have);
+        begin_ += have;
+        while (have < size) {
+            if (!readable()) {
+                return false;
+            }
+            ssize_t got = ::read(fd_, out + have, size - have);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                if (got < 0 || have > 0) {
+                    error_ = got < 0 ? strerror(errno) : "Stream ends partway through a frame";
+                }
+                return false;
+            }
+            have += static_cast<size_t>(got);
+        }
+        return true;
+    }
+
+    // Header lines are short; they go through a small buffer, so at most a
+    // few hundred bytes of each frame are copied.
+    bool read_line(std::string& line) {
+        line.clear();
+        for (;;) {
+            const void* newline = memchr(buffer_ + begin_, '\n', end_ - begin_);
+            size_t take = newline != nullptr ? static_cast<size_t>(static_cast<const unsigned char*>(newline) - buffer_) - begin_ : end_ - begin_;
+            line.append(reinterpret_cast<const char*>(buffer_ + begin_), take);
+            begin_ += take;
+            if (newline != nullptr) {
+                begin_++;
+                return true;
+            }
+            if (line.size() > 4096) {
+                error_ = "Y4M header line too long";
+                return false;
+            }
+            // whatever frame data comes along is handed over by read_exact
+            if (!readable()) {
+                return false;
+            }
+            ssize_t got = ::read(fd_, buffer_, sizeof(buffer_));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            if (got <= 0) {
+                if (got < 0 || !line.empty()) {
+                    error_ = got < 0 ? strerror(errno) : "Stream ends partway through a header";
+                }
+                return false;
+            }
+            begin_ = 0;
+            end_ = static_cast<size_t>(got);
+        }
+    }
+
+    // Waits for data while watching the stop flag; false once it is set. An
+    // error from poll is left for the read that follows to report.
+    bool readable() {
+        if (stop_ == nullptr) {
+            return true;
+        }
+        for (;;) {
+            if (*stop_) {
+                return false;
+            }
+            pollfd wait = {fd_, POLLIN, 0};
+            int ready = ::poll(&wait, 1, 100);
+            if (ready != 0 && !(ready < 0 && errno == EINTR)) {
+                return true;
+            }
+        }
+    }
+
+    int fd_;
+    size_t slots_;
+    size_t next_slot_;
+    bool y4m_;
+    double fps_;
+    ImageView frame_;
+    size_t frame_bytes_;
+    std::vector<std::unique_ptr<unsigned char[]>> ring_;
+    unsigned char buffer_[256];
+    size_t begin_;
+    size_t end_;
+    const volatile sig_atomic_t* stop_;
+    std::string error_;
+};
+
+#endif
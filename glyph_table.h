@@ -0,0 +1,46 @@
+/**
+ * @brief Luminance to glyph lookup, compiled once from the palette
+ *
+ * Every output cell used to work out its glyph with two integer divides.
+ * The table does that arithmetic up front for all 256 block averages and
+ * keeps each glyph already doubled, so a cell is one 2-byte copy. Palettes
+ * known at compile time get their table built by the compiler.
+ */
+
+#ifndef GLYPH_TABLE_H
+#define GLYPH_TABLE_H
+
+#include <cstddef>
+#include <string>
+
+class GlyphTable {
+public:
+    constexpr GlyphTable() : pairs_{} {}
+
+    // palette runs from darkest to brightest and holds 2 to 256 glyphs.
+    constexpr GlyphTable(const char* palette, size_t length) : pairs_{} {
+        for (int luma = 0; luma < 256; luma++) {
+            char glyph = palette[glyph_index(luma, length)];
+            pairs_[2 * luma] = glyph;
+            pairs_[2 * luma + 1] = glyph;
+        }
+    }
+
+    explicit GlyphTable(const std::string& palette) : GlyphTable(palette.data(), palette.length()) {}
+
+    // The mapping the renderer has always used: luma * 100 / (25500 / (length - 1)),
+    // clamped to the last glyph.
+    static constexpr size_t glyph_index(int luma, size_t length) {
+        size_t index = static_cast<size_t>(luma) * 100 / (25500 / (length - 1));
+        return index < length - 1 ? index : length - 1;
+    }
+
+    // Two copies of the glyph for a block average in 0..255.
+    const char* pair(int luma) const { return &pairs_[2 * luma]; }
+    constexpr char glyph(int luma) const { return pairs_[2 * luma]; }
+
+private:
+    char pairs_[512];
+};
+
+#endif
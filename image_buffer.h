@@ -0,0 +1,98 @@
+/**
+ * @brief Decoded pixel storage that adopts the decoder's allocation
+ *
+ * ImageBuffer owns pixels exactly as the decoder handed them over and frees
+ * them with the matching release function, so nothing is copied after decode.
+ * Everything downstream reads through an ImageView, which never owns.
+ */
+
+#ifndef IMAGE_BUFFER_H
+#define IMAGE_BUFFER_H
+
+#include <cstddef>
+#include <utility>
+
+struct ImageView {
+    const unsigned char* pixels = nullptr;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    ptrdiff_t stride = 0;  // bytes from one row to the next, negative for bottom-up rows
+    bool bgr = false;      // blue comes first, as BMP and TGA store it
+
+    const unsigned char* row(int i) const { return pixels + stride * static_cast<ptrdiff_t>(i); }
+    bool empty() const { return pixels == nullptr || width <= 0 || height <= 0; }
+};
+
+class ImageBuffer {
+public:
+    typedef void (*Release)(void*);
+
+    ImageBuffer() : pixels_(nullptr), release_(nullptr), width_(0), height_(0), channels_(0), stride_(0) {}
+
+    // Takes ownership of pixels; release(pixels) is called when the buffer goes away.
+    ImageBuffer(unsigned char* pixels, Release release, int width, int height, int channels, size_t stride = 0)
+        : pixels_(pixels), release_(release), width_(width), height_(height), channels_(channels),
+          stride_(stride != 0 ? stride : static_cast<size_t>(width) * channels) {}
+
+    ~ImageBuffer() { reset(); }
+
+    ImageBuffer(ImageBuffer&& other) noexcept : ImageBuffer() { swap(other); }
+
+    ImageBuffer& operator=(ImageBuffer&& other) noexcept {
+        if (this != &other) {
+            reset();
+            swap(other);
+        }
+        return *this;
+    }
+
+    ImageBuffer(const ImageBuffer&) = delete;
+    ImageBuffer& operator=(const ImageBuffer&) = delete;
+
+    void reset() {
+        if (pixels_ != nullptr && release_ != nullptr) {
+            release_(pixels_);
+        }
+        pixels_ = nullptr;
+        release_ = nullptr;
+        width_ = height_ = channels_ = 0;
+        stride_ = 0;
+    }
+
+    void swap(ImageBuffer& other) noexcept {
+        std::swap(pixels_, other.pixels_);
+        std::swap(release_, other.release_);
+        std::swap(width_, other.width_);
+        std::swap(height_, other.height_);
+        std::swap(channels_, other.channels_);
+        std::swap(stride_, other.stride_);
+    }
+
+    ImageView view() const {
+        ImageView v;
+        v.pixels = pixels_;
+        v.width = width_;
+        v.height = height_;
+        v.channels = channels_;
+        v.stride = static_cast<ptrdiff_t>(stride_);
+        return v;
+    }
+
+    const unsigned char* data() const { return pixels_; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    int channels() const { return channels_; }
+    size_t stride() const { return stride_; }
+    bool empty() const { return pixels_ == nullptr; }
+
+private:
+    unsigned char* pixels_;
+    Release release_;
+    int width_;
+    int height_;
+    int channels_;
+    size_t stride_;
+};
+
+#endif
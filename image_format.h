@@ -0,0 +1,146 @@
+/**
+ * @brief Picks the decoder from the file's magic bytes instead of probing
+ *
+ * stbi_load_* runs the PNG, BMP, GIF, PSD and PIC tests before it even looks
+ * for a JPEG, rewinding after each one. Every format but TGA starts with a
+ * signature, so one look at the first bytes is enough to call the right stb
+ * loader directly. Callers with trusted input can skip even that by passing
+ * the format. Needs the stb_image implementation in the same translation unit.
+ */
+
+#ifndef IMAGE_FORMAT_H
+#define IMAGE_FORMAT_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+enum class ImageFormat {
+    Unknown,  // sniff it, and failing that let stb_image probe for it
+    Jpeg,
+    Png,
+    Bmp,
+    Gif,
+    Psd,
+    Pic,
+    Pnm,
+    Hdr,
+    Tga,
+};
+
+static bool image_starts_with(const unsigned char* bytes, size_t len, const char* magic, size_t at = 0) {
+    size_t n = strlen(magic);
+    return len >= at + n && memcmp(bytes + at, magic, n) == 0;
+}
+
+// Recognises every format stb_image reads except TGA, which has no signature.
+inline ImageFormat sniff_image_format(const unsigned char* bytes, size_t len) {
+    if (len >= 3 && bytes[0] == 0xff && bytes[1] == 0xd8 && bytes[2] == 0xff) {
+        return ImageFormat::Jpeg;
+    }
+    if (image_starts_with(bytes, len, "\x89PNG\r\n\x1a\n")) {
+        return ImageFormat::Png;
+    }
+    if (image_starts_with(bytes, len, "BM")) {
+        return ImageFormat::Bmp;
+    }
+    if (image_starts_with(bytes, len, "GIF87a") || image_starts_with(bytes, len, "GIF89a")) {
+        return ImageFormat::Gif;
+    }
+    if (image_starts_with(bytes, len, "8BPS")) {
+        return ImageFormat::Psd;
+    }
+    if (image_starts_with(bytes, len, "\x53\x80\xf6\x34") && image_starts_with(bytes, len, "PICT", 88)) {
+        return ImageFormat::Pic;
+    }
+    if (image_starts_with(bytes, len, "P5") || image_starts_with(bytes, len, "P6")) {
+        return ImageFormat::Pnm;
+    }
+    if (image_starts_with(bytes, len, "#?RADIANCE\n") || image_starts_with(bytes, len, "#?RGBE\n")) {
+        return ImageFormat::Hdr;
+    }
+    return ImageFormat::Unknown;
+}
+
+// Accepts the usual names and extensions: "jpeg", "jpg", "ppm", ...
+// "auto" is Unknown. Returns false for anything else.
+inline bool parse_image_format(const std::string& name, ImageFormat& format) {
+    static const struct {
+        const char* name;
+        ImageFormat format;
+    } names[] = {
+        {"auto", ImageFormat::Unknown}, {"jpeg", ImageFormat::Jpeg}, {"jpg", ImageFormat::Jpeg},
+        {"png", ImageFormat::Png},      {"bmp", ImageFormat::Bmp},   {"gif", ImageFormat::Gif},
+        {"psd", ImageFormat::Psd},      {"pic", ImageFormat::Pic},   {"pnm", ImageFormat::Pnm},
+        {"ppm", ImageFormat::Pnm},      {"pgm", ImageFormat::Pnm},   {"hdr", ImageFormat::Hdr},
+        {"tga", ImageFormat::Tga},
+    };
+    for (const auto& entry : names) {
+        if (name == entry.name) {
+            format = entry.format;
+            return true;
+        }
+    }
+    return false;
+}
+
+// stbi__load_main, minus the probing: format picks the loader, Unknown
+// sniffs first. Unrecognised input still gets stb_image's full probe, and
+// so does input the sniffed loader rejects, in case the signature lied.
+static void* image_load_main(stbi__context* s, ImageFormat format, int* x, int* y, int* comp, int req_comp, stbi__result_info* ri) {
+    bool sniffed = false;
+    if (format == ImageFormat::Unknown) {
+        format = sniff_image_format(s->img_buffer, static_cast<size_t>(s->img_buffer_end - s->img_buffer));
+        sniffed = true;
+    }
+
+    memset(ri, 0, sizeof(*ri));
+    ri->bits_per_channel = 8;
+    ri->channel_order = STBI_ORDER_RGB;
+    ri->num_channels = 0;
+
+    void* result = nullptr;
+    switch (format) {
+        case ImageFormat::Jpeg: result = stbi__jpeg_load(s, x, y, comp, req_comp, ri); break;
+        case ImageFormat::Png: result = stbi__png_load(s, x, y, comp, req_comp, ri); break;
+        case ImageFormat::Bmp: result = stbi__bmp_load(s, x, y, comp, req_comp, ri); break;
+        case ImageFormat::Gif: result = stbi__gif_load(s, x, y, comp, req_comp, ri); break;
+        case ImageFormat::Psd: result = stbi__psd_load(s, x, y, comp, req_comp, ri, 8); break;
+        case ImageFormat::Pic: result = stbi__pic_load(s, x, y, comp, req_comp, ri); break;
+        case ImageFormat::Pnm: result = stbi__pnm_load(s, x, y, comp, req_comp, ri); break;
+        case ImageFormat::Tga: result = stbi__tga_load(s, x, y, comp, req_comp, ri); break;
+        case ImageFormat::Hdr: {
+            float* hdr = stbi__hdr_load(s, x, y, comp, req_comp, ri);
+            result = hdr != nullptr ? stbi__hdr_to_ldr(hdr, *x, *y, req_comp ? req_comp : *comp) : nullptr;
+            break;
+        }
+        case ImageFormat::Unknown: return stbi__load_main(s, x, y, comp, req_comp, ri, 8);
+    }
+    if (result == nullptr && sniffed) {
+        stbi__rewind(s);
+        return stbi__load_main(s, x, y, comp, req_comp, ri, 8);
+    }
+    return result;
+}
+
+// stbi_load_from_memory with the format known up front (or sniffed). Same
+// output, freed with stbi_image_free.
+inline unsigned char* image_load_from_memory(const unsigned char* bytes, int len, int* x, int* y, int* comp, int req_comp,
+                                             ImageFormat format = ImageFormat::Unknown) {
+    stbi__context s;
+    stbi__start_mem(&s, bytes, len);
+    stbi__result_info ri;
+    void* result = image_load_main(&s, format, x, y, comp, req_comp, &ri);
+    if (result == nullptr) {
+        return nullptr;
+    }
+    if (ri.bits_per_channel != 8) {
+        result = stbi__convert_16_to_8(static_cast<stbi__uint16*>(result), *x, *y, req_comp == 0 ? *comp : req_comp);
+    }
+    if (stbi__vertically_flip_on_load) {
+        stbi__vertical_flip(result, *x, *y, req_comp ? req_comp : *comp);
+    }
+    return static_cast<unsigned char*>(result);
+}
+
+#endif
@@ -0,0 +1,494 @@
+/**
+ * @brief Incremental zlib inflate for row-at-a-time PNG decoding
+ *
+ * stb_image inflates a whole zlib stream into one buffer that it keeps
+ * doubling. InflateStream instead decodes on demand into a buffer that only
+ * holds the 32 KiB window plus one chunk of fresh output, pulling compressed
+ * input from its source in whatever pieces it comes in (one per IDAT chunk
+ * for PNG).
+ *
+ * The hot loop works off a 64-bit bit buffer refilled eight bytes at a time,
+ * resolves literal/length codes of up to 11 bits (distance codes up to 10)
+ * together with their extra-bit counts in one table lookup, and copies
+ * matches eight bytes at a time. Longer codes, and the validity rules, are
+ * stb_image's, so output is byte for byte what stb_image inflates; it needs
+ * the stb_image implementation in the same translation unit.
+ */
+
+#ifndef INFLATE_STREAM_H
+#define INFLATE_STREAM_H
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <vector>
+
+class InflateStream {
+public:
+    // Hands out the next piece of compressed input; false when there is none.
+    typedef std::function<bool(const unsigned char*& data, size_t& size)> Source;
+
+    explicit InflateStream(Source source)
+        : source_(source), in_(nullptr), in_end_(nullptr), code_(0), bits_(0), zeros_(0),
+          state_(Start), last_block_(false), stored_left_(0),
+          buffer_(window + chunk + max_match + copy_slack), read_(0), out_(0) {}
+
+    // Copies the next n inflated bytes to out. False if the stream is corrupt
+    // or ends before n more bytes.
+    bool read(unsigned char* out, size_t n) {
+        while (n > 0) {
+            if (read_ == out_ && !produce()) {
+                return false;
+            }
+            size_t take = n < out_ - read_ ? n : out_ - read_;
+            memcpy(out, buffer_.data() + read_, take);
+            read_ += take;
+            out += take;
+            n -= take;
+        }
+        return true;
+    }
+
+private:
+    static const size_t window = 1 << 15;
+    static const size_t chunk = 1 << 16;
+    static const size_t max_match = 258;
+    static const size_t copy_slack = 8;  // wide match copies may run this far past the end
+
+    static const int length_bits = 11;
+    static const int distance_bits = 10;
+
+    enum State { Start, Header, Stored, Huffman, Done };
+
+    // One fast-table slot: the symbol (or base length/distance) a code of
+    // `bits` bits resolves to and how many extra bits follow it. bits == 0
+    // means the code is longer than the table and takes the slow path.
+    struct Entry {
+        uint16_t value;
+        uint8_t bits;
+        uint8_t extra;
+    };
+
+    static const uint8_t literal = 0x80;
+    static const uint8_t end_of_block = 0x40;
+    static const uint8_t invalid = 0x20;
+    static const uint8_t extra_mask = 0x1f;
+
+    static Entry length_entry(int symbol) {
+        Entry e = {0, 0, 0};
+        if (symbol < 256) {
+            e.value = static_cast<uint16_t>(symbol);
+            e.extra = literal;
+        } else if (symbol == 256) {
+            e.extra = end_of_block;
+        } else if (symbol < 286) {
+            e.value = static_cast<uint16_t>(stbi__zlength_base[symbol - 257]);
+            e.extra = static_cast<uint8_t>(stbi__zlength_extra[symbol - 257]);
+        } else {
+            e.extra = invalid;
+        }
+        return e;
+    }
+
+    static Entry distance_entry(int symbol) {
+        Entry e = {0, 0, invalid};
+        if (symbol < 30) {
+            e.value = static_cast<uint16_t>(stbi__zdist_base[symbol]);
+            e.extra = static_cast<uint8_t>(stbi__zdist_extra[symbol]);
+        }
+        return e;
+    }
+
+    // Fills the fast table for the canonical code with these lengths. The
+    // lengths have already passed stbi__zbuild_huffman, so they are sane.
+    template <int Bits>
+    static void build_fast(Entry (&table)[1 << Bits], const stbi_uc* lengths, int count, Entry (*describe)(int)) {
+        memset(table, 0, sizeof(table));
+        int counts[16] = {0};
+        for (int i = 0; i < count; i++) {
+            counts[lengths[i]]++;
+        }
+        counts[0] = 0;
+        int next[16];
+        int code = 0;
+        for (int len = 1; len < 16; len++) {
+            code = (code + counts[len - 1]) << 1;
+            next[len] = code;
+        }
+        for (int symbol = 0; symbol < count; symbol++) {
+            int len = lengths[symbol];
+            if (len == 0) {
+                continue;
+            }
+            int reversed = stbi__bit_reverse(next[len]++, len);
+            if (len > Bits) {
+                continue;
+            }
+            Entry e = describe(symbol);
+            e.bits = static_cast<uint8_t>(len);
+            for (int i = reversed; i < (1 << Bits); i += 1 << len) {
+                table[i] = e;
+            }
+        }
+    }
+
+    bool build_tables(const stbi_uc* lengths, int hlit, int hdist) {
+        if (!stbi__zbuild_huffman(&length_, lengths, hlit) || !stbi__zbuild_huffman(&distance_, lengths + hlit, hdist)) {
+            return false;
+        }
+        build_fast<length_bits>(length_fast_, lengths, hlit, length_entry);
+        build_fast<distance_bits>(distance_fast_, lengths + hlit, hdist, distance_entry);
+        return true;
+    }
+
+    // -- bit input ------------------------------------------------------
+
+    int next_byte() {
+        while (in_ == in_end_) {
+            size_t size = 0;
+            if (!source_(in_, size)) {
+                in_ = in_end_ = nullptr;
+                zeros_++;
+                return 0;
+            }
+            in_end_ = in_ + size;
+        }
+        return *in_++;
+    }
+
+    // Byte at a time, across input pieces and past the end.
+    void fill() {
+        while (bits_ < 56) {
+            code_ |= static_cast<uint64_t>(next_byte()) << bits_;
+            bits_ += 8;
+        }
+    }
+
+    // Tops the buffer up to at least 56 bits. With eight bytes of input at
+    // hand it loads them all and advances by however many whole bytes fit;
+    // the bits above bits_ then already hold the next input bytes, which is
+    // why loading them again later (either way) changes nothing.
+    void refill() {
+        if (in_end_ - in_ < 8) {
+            fill();
+            return;
+        }
+        uint64_t word;
+        memcpy(&word, in_, 8);
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        code_ |= word << bits_;
+        in_ += (63 - bits_) >> 3;
+        bits_ |= 56;
+    }
+
+    int take(int n) {
+        int value = static_cast<int>(code_ & ((uint64_t(1) << n) - 1));
+        code_ >>= n;
+        bits_ -= n;
+        return value;
+    }
+
+    int receive(int n) {
+        if (bits_ < n) {
+            fill();
+        }
+        return take(n);
+    }
+
+    // Past the end of input the bit buffer is topped up with zero bytes so
+    // decoding can look ahead; actually consuming any of them is corruption.
+    bool overran() const { return zeros_ * 8 > bits_; }
+
+    int decode(const stbi__zhuffman& table) {
+        if (bits_ < 16) {
+            fill();
+        }
+        int fast = table.fast[code_ & STBI__ZFAST_MASK];
+        if (fast) {
+            int size = fast >> 9;
+            code_ >>= size;
+            bits_ -= size;
+            return fast & 511;
+        }
+        // longer codes are matched MSB first, as stb_image does
+        int k = stbi__bit_reverse(static_cast<int>(code_ & 0xffff), 16);
+        int size = STBI__ZFAST_BITS + 1;
+        while (size < 16 && k >= table.maxcode[size]) {
+            size++;
+        }
+        if (size >= 16) {
+            return -1;
+        }
+        int b = (k >> (16 - size)) - table.firstcode[size] + table.firstsymbol[size];
+        if (b >= STBI__ZNSYMS || table.size[b] != size) {
+            return -1;
+        }
+        code_ >>= size;
+        bits_ -= size;
+        return table.value[b];
+    }
+
+    // -- block structure ------------------------------------------------
+
+    bool zlib_header() {
+        int cmf = next_byte();
+        int flg = next_byte();
+        return zeros_ == 0 && (cmf * 256 + flg) % 31 == 0 && !(flg & 32) && (cmf & 15) == 8;
+    }
+
+    bool dynamic_tables() {
+        static const unsigned char order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+        stbi_uc lengths[286 + 32 + 137];
+        stbi_uc code_sizes[19] = {0};
+        stbi__zhuffman code_table;
+
+        int hlit = receive(5) + 257;
+        int hdist = receive(5) + 1;
+        int hclen = receive(4) + 4;
+        for (int i = 0; i < hclen; i++) {
+            code_sizes[order[i]] = static_cast<stbi_uc>(receive(3));
+        }
+        if (!stbi__zbuild_huffman(&code_table, code_sizes, 19)) {
+            return false;
+        }
+
+        int total = hlit + hdist;
+        int n = 0;
+        while (n < total) {
+            int c = decode(code_table);
+            if (c < 0 || c >= 19) {
+                return false;
+            }
+            if (c < 16) {
+                lengths[n++] = static_cast<stbi_uc>(c);
+                continue;
+            }
+            stbi_uc fill_value = 0;
+            int repeat;
+            if (c == 16) {
+                if (n == 0) {
+                    return false;
+                }
+                repeat = receive(2) + 3;
+                fill_value = lengths[n - 1];
+            } else if (c == 17) {
+                repeat = receive(3) + 3;
+            } else {
+                repeat = receive(7) + 11;
+            }
+            if (total - n < repeat) {
+                return false;
+            }
+            memset(lengths + n, fill_value, repeat);
+            n += repeat;
+        }
+        return build_tables(lengths, hlit, hdist);
+    }
+
+    bool block_header() {
+        if (last_block_) {
+            state_ = Done;
+            return true;
+        }
+        last_block_ = receive(1) != 0;
+        int type = receive(2);
+        if (type == 0) {
+            receive(bits_ & 7);
+            unsigned char header[4];
+            for (int k = 0; k < 4; k++) {
+                header[k] = static_cast<unsigned char>(receive(8));
+            }
+            int len = header[1] * 256 + header[0];
+            int nlen = header[3] * 256 + header[2];
+            if (nlen != (len ^ 0xffff)) {
+                return false;
+            }
+            stored_left_ = static_cast<size_t>(len);
+            state_ = Stored;
+        } else if (type == 1) {
+            stbi_uc lengths[STBI__ZNSYMS + 32];
+            memcpy(lengths, stbi__zdefault_length, STBI__ZNSYMS);
+            memcpy(lengths + STBI__ZNSYMS, stbi__zdefault_distance, 32);
+            if (!build_tables(lengths, STBI__ZNSYMS, 32)) {
+                return false;
+            }
+            state_ = Huffman;
+        } else if (type == 2) {
+            if (!dynamic_tables()) {
+                return false;
+            }
+            state_ = Huffman;
+        } else {
+            return false;
+        }
+        return !overran();
+    }
+
+    // Stored bytes come out of the bit buffer first, then straight from input.
+    bool copy_stored(size_t limit) {
+        while (stored_left_ > 0 && out_ < limit && bits_ >= 8) {
+            unsigned char byte = static_cast<unsigned char>(take(8));
+            if (overran()) {
+                return false;
+            }
+            buffer_[out_++] = byte;
+            stored_left_--;
+        }
+        if (stored_left_ > 0 && out_ < limit) {
+            // the buffer is empty now; drop what refill() loaded ahead, it is read directly
+            code_ = 0;
+            bits_ = 0;
+        }
+        while (stored_left_ > 0 && out_ < limit) {
+            if (in_ == in_end_) {
+                unsigned char byte = static_cast<unsigned char>(next_byte());
+                if (overran()) {
+                    return false;
+                }
+                buffer_[out_++] = byte;
+                stored_left_--;
+                continue;
+            }
+            size_t n = std::min(std::min(stored_left_, limit - out_), static_cast<size_t>(in_end_ - in_));
+            memcpy(buffer_.data() + out_, in_, n);
+            in_ += n;
+            out_ += n;
+            stored_left_ -= n;
+        }
+        if (stored_left_ == 0) {
+            state_ = Header;
+        }
+        return !overran();
+    }
+
+    bool inflate_block(size_t limit) {
+        unsigned char* buffer = buffer_.data();
+        while (out_ < limit) {
+            // one refill covers the longest symbol: 15 + 5 + 15 + 13 bits
+            refill();
+            Entry e = length_fast_[code_ & ((1 << length_bits) - 1)];
+            if (e.bits != 0) {
+                take(e.bits);
+            } else {
+                int symbol = decode(length_);
+                if (symbol < 0) {
+                    return false;
+                }
+                e = length_entry(symbol);
+            }
+
+            // nothing decoded from the zero padding past the input is written;
+            // zeros_ is only set once the input has run out
+            if (zeros_ != 0 && overran()) {
+                return false;
+            }
+            if (e.extra & literal) {
+                buffer[out_++] = static_cast<unsigned char>(e.value);
+                continue;
+            }
+            if (e.extra & end_of_block) {
+                state_ = Header;
+                return !overran();
+            }
+            if (e.extra & invalid) {
+                return false;
+            }
+            size_t len = e.value + static_cast<size_t>(take(e.extra));
+
+            Entry d = distance_fast_[code_ & ((1 << distance_bits) - 1)];
+            if (d.bits != 0) {
+                take(d.bits);
+            } else {
+                int symbol = decode(distance_);
+                if (symbol < 0) {
+                    return false;
+                }
+                d = distance_entry(symbol);
+            }
+            if (d.extra & invalid) {
+                return false;
+            }
+            size_t dist = d.value + static_cast<size_t>(take(d.extra));
+            if (dist > out_ || (zeros_ != 0 && overran())) {
+                return false;
+            }
+
+            unsigned char* to = buffer + out_;
+            const unsigned char* from = to - dist;
+            if (dist >= 8) {
+                // whole words; each one only reads bytes already written
+                for (size_t k = 0; k < len; k += 8) {
+                    uint64_t word;
+                    memcpy(&word, from + k, 8);
+                    memcpy(to + k, &word, 8);
+                }
+            } else if (dist == 1) {
+                memset(to, *from, len);
+            } else {
+                for (size_t k = 0; k < len; k++) {
+                    to[k] = from[k];
+                }
+            }
+            out_ += len;
+        }
+        return !overran();
+    }
+
+    // Decodes up to one chunk of output once everything before it has been read.
+    bool produce() {
+        if (state_ == Done) {
+            return false;
+        }
+        if (out_ + chunk + max_match + copy_slack > buffer_.size()) {
+            // keep only the window matches may still reach back into
+            memmove(buffer_.data(), buffer_.data() + out_ - window, window);
+            out_ = read_ = window;
+        }
+
+        size_t limit = out_ + chunk;
+        size_t start = out_;
+        while (out_ == start || (out_ < limit && state_ != Done)) {
+            bool ok = true;
+            switch (state_) {
+                case Start: ok = zlib_header(); state_ = Header; break;
+                case Header: ok = block_header(); break;
+                case Stored: ok = copy_stored(limit); break;
+                case Huffman: ok = inflate_block(limit); break;
+                case Done: return out_ > start;
+            }
+            if (!ok) {
+                // output stops short of the first symbol that needed bits past
+                // the input, so what is there came from real data and is still
+                // handed out, as stb_image does; the read after it fails
+                state_ = Done;
+                return out_ > start;
+            }
+        }
+        return true;
+    }
+
+    Source source_;
+    const unsigned char* in_;
+    const unsigned char* in_end_;
+    uint64_t code_;
+    int bits_;
+    int zeros_;
+
+    State state_;
+    bool last_block_;
+    size_t stored_left_;
+    stbi__zhuffman length_;
+    stbi__zhuffman distance_;
+    Entry length_fast_[1 << length_bits];
+    Entry distance_fast_[1 << distance_bits];
+
+    std::vector<unsigned char> buffer_;
+    size_t read_;
+    size_t out_;
+};
+
+#endif
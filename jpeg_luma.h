@@ -0,0 +1,686 @@
+/**
+ * @brief Luminance-only JPEG decoding on top of stb_image's decoder
+ *
+ * The renderer only looks at brightness, so for YCbCr and grayscale JPEGs the
+ * Y plane is all it needs. Chroma blocks are still entropy-decoded where the
+ * bitstream interleaves them (there is no other way past them) but are never
+ * IDCT'd, upsampled or colour converted, and chroma-only scans are skipped
+ * outright. Needs the stb_image implementation in the same translation unit.
+ *
+ * The Y plane can also come out at 1/2, 1/4 or 1/8 size: each 8x8 block then
+ * goes through a reduced IDCT over its low-frequency coefficients (just the
+ * DC term at 1/8) instead of a full one that the renderer would average away.
+ *
+ * Baseline files with restart markers can have their Y scan split at the
+ * markers and the intervals entropy-decoded on a ThreadPool, each worker with
+ * its own copy of the decoder state writing its own blocks of the plane.
+ */
+
+#ifndef JPEG_LUMA_H
+#define JPEG_LUMA_H
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cmath>
+#include <cstring>
+#include <future>
+#include <string>
+#include <vector>
+
+#include "image_buffer.h"
+#include "image_format.h"
+#include "mapped_file.h"
+#include "png_stream.h"
+#include "thread_pool.h"
+
+typedef void (*JpegIdctKernel)(stbi_uc* out, int out_stride, short data[64]);
+
+// Fixed-point (x 4096) basis for an N-point IDCT fed with the top-left N x N
+// coefficients of an 8-point block. The sqrt(N / 8) keeps the DC term
+// producing the block mean, like the full IDCT does.
+template <int N>
+struct JpegReducedIdctTable {
+    int basis[N][N];
+
+    JpegReducedIdctTable() {
+        const double pi = 3.14159265358979323846;
+        for (int x = 0; x < N; x++) {
+            for (int u = 0; u < N; u++) {
+                double alpha = u == 0 ? std::sqrt(1.0 / N) : std::sqrt(2.0 / N);
+                double c = alpha * std::sqrt(N / 8.0) * std::cos((2 * x + 1) * u * pi / (2 * N));
+                basis[x][u] = static_cast<int>(std::lround(c * 4096));
+            }
+        }
+    }
+};
+
+template <int N>
+static void jpeg_idct_reduced(stbi_uc* out, int out_stride, short data[64]) {
+    static const JpegReducedIdctTable<N> table;
+    int rows[N][N];
+    for (int v = 0; v < N; v++) {
+        for (int x = 0; x < N; x++) {
+            int sum = 0;
+            for (int u = 0; u < N; u++) {
+                sum += table.basis[x][u] * data[v * 8 + u];
+            }
+            rows[v][x] = (sum + 2048) >> 12;
+        }
+    }
+    for (int y = 0; y < N; y++) {
+        for (int x = 0; x < N; x++) {
+            int sum = 0;
+            for (int v = 0; v < N; v++) {
+                sum += table.basis[y][v] * rows[v][x];
+            }
+            out[y * out_stride + x] = stbi__clamp(((sum + 2048) >> 12) + 128);
+        }
+    }
+}
+
+// 1/8: the block mean is the DC coefficient over 8.
+static void jpeg_idct_dc(stbi_uc* out, int, short data[64]) {
+    out[0] = stbi__clamp((data[0] >> 3) + 128);
+}
+
+// Output geometry when decoding at 1/reduce size: every 8x8 block becomes
+// block x block pixels in a plane `reduce` times narrower than the MCU grid.
+struct JpegLumaScale {
+    int reduce;
+    int block;
+    int stride;
+    JpegIdctKernel idct;
+};
+
+static JpegLumaScale jpeg_luma_scale(const stbi__jpeg* z, int reduce) {
+    // an image smaller than one reduced pixel is not worth the trouble
+    if (reduce != 2 && reduce != 4 && reduce != 8) {
+        reduce = 1;
+    }
+    if (z->s->img_x < static_cast<stbi__uint32>(reduce) || z->s->img_y < static_cast<stbi__uint32>(reduce)) {
+        reduce = 1;
+    }
+    JpegLumaScale scale;
+    scale.reduce = reduce;
+    scale.block = 8 / reduce;
+    scale.stride = z->img_comp[0].w2 / reduce;
+    switch (reduce) {
+        case 2: scale.idct = jpeg_idct_reduced<4>; break;
+        case 4: scale.idct = jpeg_idct_reduced<2>; break;
+        case 8: scale.idct = jpeg_idct_dc; break;
+        default: scale.idct = z->idct_block_kernel; break;
+    }
+    return scale;
+}
+
+// Reduced output keeps only the pixels that lie wholly inside the image, so the
+// renderer's grid of scalar-sized blocks lands exactly where it would at full size.
+static void jpeg_luma_size(const stbi__jpeg* z, const JpegLumaScale& scale, int* x, int* y) {
+    *x = scale.reduce == 1 ? z->s->img_x : z->s->img_x / scale.reduce;
+    *y = scale.reduce == 1 ? z->s->img_y : z->s->img_y / scale.reduce;
+}
+
+// Largest reduction that still divides the render scale, so no detail the
+// output could show is thrown away.
+inline int jpeg_reduction_for_scale(int scalar) {
+    for (int reduce = 8; reduce > 1; reduce /= 2) {
+        if (scalar % reduce == 0) {
+            return reduce;
+        }
+    }
+    return 1;
+}
+
+// Jumps over the entropy-coded data of a scan we have no use for, restart
+// markers included, and leaves the next real marker cached on the decoder.
+static int jpeg_luma_skip_scan(stbi__jpeg* z) {
+    stbi_uc m;
+    do {
+        m = stbi__skip_jpeg_junk_at_end(z);
+    } while (STBI__RESTART(m));
+    z->marker = m;
+    return 1;
+}
+
+static int jpeg_luma_parse_entropy_coded_data(stbi__jpeg* z, const JpegLumaScale& scale) {
+    STBI_SIMD_ALIGN(short, data[64]);
+    stbi_uc* plane = z->img_comp[0].data;
+
+    if (z->scan_n == 1) {
+        if (z->order[0] != 0) {
+            return jpeg_luma_skip_scan(z);
+        }
+        if (z->progressive) {
+            // progressive scans only gather coefficients, jpeg_luma_finish does the IDCT
+            return stbi__parse_entropy_coded_data(z);
+        }
+        stbi__jpeg_reset(z);
+        int w = (z->img_comp[0].x + 7) >> 3;
+        int h = (z->img_comp[0].y + 7) >> 3;
+        int ha = z->img_comp[0].ha;
+        for (int j = 0; j < h; ++j) {
+            for (int i = 0; i < w; ++i) {
+                if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[0].hd, z->huff_ac + ha, z->fast_ac[ha], 0, z->dequant[z->img_comp[0].tq])) return 0;
+                scale.idct(plane + scale.stride * j * scale.block + i * scale.block, scale.stride, data);
+                if (--z->todo <= 0) {
+                    if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+                    if (!STBI__RESTART(z->marker)) return 1;
+                    stbi__jpeg_reset(z);
+                }
+            }
+        }
+        return 1;
+    }
+
+    stbi__jpeg_reset(z);
+    STBI_SIMD_ALIGN(short, discard[64]);
+    for (int j = 0; j < z->img_mcu_y; ++j) {
+        for (int i = 0; i < z->img_mcu_x; ++i) {
+            for (int k = 0; k < z->scan_n; ++k) {
+                int n = z->order[k];
+                for (int y = 0; y < z->img_comp[n].v; ++y) {
+                    for (int x = 0; x < z->img_comp[n].h; ++x) {
+                        int x2 = i * z->img_comp[n].h + x;
+                        int y2 = j * z->img_comp[n].v + y;
+                        if (z->progressive) {
+                            short* block = discard;
+                            if (n == 0) {
+                                block = z->img_comp[0].coeff + 64 * (x2 + y2 * z->img_comp[0].coeff_w);
+                            }
+                            if (!stbi__jpeg_decode_block_prog_dc(z, block, &z->huff_dc[z->img_comp[n].hd], n)) return 0;
+                        } else {
+                            int ha = z->img_comp[n].ha;
+                            if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                            if (n == 0) {
+                                scale.idct(plane + scale.stride * y2 * scale.block + x2 * scale.block, scale.stride, data);
+                            }
+                        }
+                    }
+                }
+            }
+            if (--z->todo <= 0) {
+                if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+                if (!STBI__RESTART(z->marker)) return 1;
+                stbi__jpeg_reset(z);
+            }
+        }
+    }
+    return 1;
+}
+
+// One restart interval of entropy-coded data, markers excluded.
+struct JpegRestartSegment {
+    const stbi_uc* begin;
+    const stbi_uc* end;
+};
+
+// Splits the entropy-coded data from `data` at its RST markers. Returns where
+// the scan stops: the 0xFF of the first other marker, or `end`.
+static const stbi_uc* jpeg_find_restart_segments(const stbi_uc* data, const stbi_uc* end,
+                                                 std::vector<JpegRestartSegment>& segments) {
+    const stbi_uc* begin = data;
+    const stbi_uc* p = data;
+    while (p + 1 < end) {
+        if (p[0] != 0xff || p[1] == 0x00) {
+            p += (p[0] == 0xff) ? 2 : 1;
+        } else if (p[1] == 0xff) {
+            p++;  // fill byte ahead of a marker
+        } else if (STBI__RESTART(p[1])) {
+            segments.push_back({begin, p});
+            p += 2;
+            begin = p;
+        } else {
+            segments.push_back({begin, p});
+            return p;
+        }
+    }
+    segments.push_back({begin, end});
+    return end;
+}
+
+// Decodes MCUs [first, last) of a baseline scan into the Y plane. The range is
+// one restart interval, so there are no markers to handle inside it.
+static int jpeg_luma_decode_mcus(stbi__jpeg* z, const JpegLumaScale& scale, int first, int last) {
+    STBI_SIMD_ALIGN(short, data[64]);
+    stbi_uc* plane = z->img_comp[0].data;
+    const bool interleaved = z->scan_n > 1;
+    const int per_row = interleaved ? z->img_mcu_x : (z->img_comp[0].x + 7) >> 3;
+    for (int mcu = first; mcu < last; ++mcu) {
+        int i = mcu % per_row;
+        int j = mcu / per_row;
+        for (int k = 0; k < z->scan_n; ++k) {
+            int n = z->order[k];
+            int h = interleaved ? z->img_comp[n].h : 1;
+            int v = interleaved ? z->img_comp[n].v : 1;
+            for (int y = 0; y < v; ++y) {
+                for (int x = 0; x < h; ++x) {
+                    int ha = z->img_comp[n].ha;
+                    if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                    if (n == 0) {
+                        scale.idct(plane + scale.stride * (j * v + y) * scale.block + (i * h + x) * scale.block, scale.stride, data);
+                    }
+                }
+            }
+        }
+    }
+    return 1;
+}
+
+// Decodes a baseline scan holding Y with its restart intervals spread over
+// pool. Scans whose markers don't add up (truncated or damaged files) are
+// left to the serial decoder, which knows how to limp through them.
+static int jpeg_luma_parse_parallel(stbi__jpeg* z, const JpegLumaScale& scale, ThreadPool& pool) {
+    const int mcus = z->scan_n > 1 ? z->img_mcu_x * z->img_mcu_y
+                                   : ((z->img_comp[0].x + 7) >> 3) * ((z->img_comp[0].y + 7) >> 3);
+    const int interval = z->restart_interval;
+    std::vector<JpegRestartSegment> segments;
+    const stbi_uc* scan_end = jpeg_find_restart_segments(z->s->img_buffer, z->s->img_buffer_end, segments);
+    if (segments.size() != static_cast<size_t>((mcus + interval - 1) / interval)) {
+        return jpeg_luma_parse_entropy_coded_data(z, scale);
+    }
+
+    // a few chunks per thread so uneven intervals still balance out
+    const size_t chunks = std::min(segments.size(), static_cast<size_t>(pool.size()) * 4);
+    std::atomic<bool> failed(false);
+    std::vector<std::future<void>> jobs;
+    for (size_t c = 0; c < chunks; c++) {
+        size_t first = segments.size() * c / chunks;
+        size_t last = segments.size() * (c + 1) / chunks;
+        jobs.push_back(pool.submit([&, first, last] {
+            stbi__context s = *z->s;
+            stbi__jpeg worker = *z;
+            worker.s = &s;
+            for (size_t seg = first; seg < last && !failed; seg++) {
+                s.img_buffer = const_cast<stbi_uc*>(segments[seg].begin);
+                s.img_buffer_end = const_cast<stbi_uc*>(segments[seg].end);
+                stbi__jpeg_reset(&worker);
+                int begin = static_cast<int>(seg) * interval;
+                if (!jpeg_luma_decode_mcus(&worker, scale, begin, std::min(mcus, begin + interval))) {
+                    failed = true;
+                }
+            }
+        }));
+    }
+    for (std::future<void>& job : jobs) {
+        job.get();
+    }
+    if (failed) {
+        return 0;
+    }
+
+    // leave the stream where the serial decoder would: at the marker after the scan
+    stbi__jpeg_reset(z);
+    z->s->img_buffer = const_cast<stbi_uc*>(scan_end);
+    return 1;
+}
+
+static int jpeg_luma_parse_scan(stbi__jpeg* z, const JpegLumaScale& scale, ThreadPool* pool) {
+    bool splittable = pool != nullptr && !z->progressive && z->restart_interval > 0 &&
+                      !z->s->read_from_callbacks && (z->scan_n > 1 || z->order[0] == 0);
+    if (splittable) {
+        return jpeg_luma_parse_parallel(z, scale, *pool);
+    }
+    return jpeg_luma_parse_entropy_coded_data(z, scale);
+}
+
+static void jpeg_luma_finish(stbi__jpeg* z, const JpegLumaScale& scale) {
+    if (!z->progressive) {
+        return;
+    }
+    int w = (z->img_comp[0].x + 7) >> 3;
+    int h = (z->img_comp[0].y + 7) >> 3;
+    for (int j = 0; j < h; ++j) {
+        for (int i = 0; i < w; ++i) {
+            short* data = z->img_comp[0].coeff + 64 * (i + j * z->img_comp[0].coeff_w);
+            stbi__jpeg_dequantize(data, z->dequant[z->img_comp[0].tq]);
+            scale.idct(z->img_comp[0].data + scale.stride * j * scale.block + i * scale.block, scale.stride, data);
+        }
+    }
+}
+
+// Y is only component 0 for real YCbCr or grayscale files at full resolution;
+// Adobe RGB, CMYK/YCCK and subsampled-luma files take the regular path.
+static bool jpeg_luma_supported(const stbi__jpeg* z) {
+    if (z->s->img_n == 1) {
+        return true;
+    }
+    if (z->s->img_n != 3) {
+        return false;
+    }
+    bool is_rgb = z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif);
+    return !is_rgb && z->img_comp[0].h == z->img_h_max && z->img_comp[0].v == z->img_v_max;
+}
+
+// Returns a tightly packed x by y plane freed with stbi_image_free, or NULL.
+// `reduce` asks for 1/2, 1/4 or 1/8 size and comes back as what was applied.
+// `unsupported` is set when the file is a JPEG this path does not handle.
+// pool, when given, decodes restart intervals in parallel.
+static stbi_uc* jpeg_decode_luma(stbi__jpeg* z, ThreadPool* pool, int* reduce, int* x, int* y, bool* unsupported) {
+    *unsupported = false;
+    for (int m = 0; m < 4; m++) {
+        z->img_comp[m].raw_data = NULL;
+        z->img_comp[m].raw_coeff = NULL;
+    }
+    z->restart_interval = 0;
+    if (!stbi__decode_jpeg_header(z, STBI__SCAN_load)) {
+        return NULL;
+    }
+    if (!jpeg_luma_supported(z)) {
+        *unsupported = true;
+        stbi__cleanup_jpeg(z);
+        return NULL;
+    }
+
+    // the frame header allocated every plane, only Y is ever written
+    for (int n = 1; n < z->s->img_n; n++) {
+        STBI_FREE(z->img_comp[n].raw_data);
+        STBI_FREE(z->img_comp[n].raw_coeff);
+        z->img_comp[n].raw_data = NULL;
+        z->img_comp[n].raw_coeff = NULL;
+        z->img_comp[n].data = NULL;
+        z->img_comp[n].coeff = NULL;
+    }
+
+    JpegLumaScale scale = jpeg_luma_scale(z, *reduce);
+    *reduce = scale.reduce;
+    if (scale.reduce > 1) {
+        STBI_FREE(z->img_comp[0].raw_data);
+        z->img_comp[0].raw_data = stbi__malloc_mad2(scale.stride, z->img_comp[0].h2 / scale.reduce, 15);
+        if (z->img_comp[0].raw_data == NULL) {
+            stbi__cleanup_jpeg(z);
+            return (stbi_uc*) stbi__errpuc("outofmem", "Out of memory");
+        }
+        z->img_comp[0].data = (stbi_uc*) (((size_t) z->img_comp[0].raw_data + 15) & ~15);
+    }
+    // blocks a truncated scan never reaches stay black, as they do when streaming
+    memset(z->img_comp[0].data, 0, static_cast<size_t>(scale.stride) * (z->img_comp[0].h2 / scale.reduce));
+
+    int m = stbi__get_marker(z);
+    while (!stbi__EOI(m)) {
+        if (stbi__SOS(m)) {
+            if (!stbi__process_scan_header(z) || !jpeg_luma_parse_scan(z, scale, pool)) {
+                stbi__cleanup_jpeg(z);
+                return NULL;
+            }
+            if (z->marker == STBI__MARKER_none) {
+                z->marker = stbi__skip_jpeg_junk_at_end(z);
+            }
+            m = stbi__get_marker(z);
+            if (STBI__RESTART(m)) {
+                m = stbi__get_marker(z);
+            }
+        } else if (stbi__DNL(m)) {
+            int Ld = stbi__get16be(z->s);
+            stbi__uint32 NL = stbi__get16be(z->s);
+            if (Ld != 4 || NL != z->s->img_y) {
+                stbi__cleanup_jpeg(z);
+                return (stbi_uc*) stbi__errpuc("bad DNL", "Corrupt JPEG");
+            }
+            m = stbi__get_marker(z);
+        } else {
+            if (!stbi__process_marker(z, m)) {
+                break;
+            }
+            m = stbi__get_marker(z);
+        }
+    }
+    jpeg_luma_finish(z, scale);
+    jpeg_luma_size(z, scale, x, y);
+
+    // compact the MCU-padded plane to the front of its own allocation
+    stbi_uc* plane = (stbi_uc*) z->img_comp[0].raw_data;
+    const stbi_uc* src = z->img_comp[0].data;
+    for (int row = 0; row < *y; row++) {
+        memmove(plane + (size_t) row * *x, src + (size_t) row * scale.stride, *x);
+    }
+    z->img_comp[0].raw_data = NULL;
+    z->img_comp[0].data = NULL;
+    stbi__cleanup_jpeg(z);
+    return plane;
+}
+
+// Fills in the MCU geometry stbi__process_frame_header computes for a full
+// load, without allocating any planes.
+static int jpeg_stream_layout(stbi__jpeg* z) {
+    stbi__context* s = z->s;
+    int h_max = 1, v_max = 1;
+    for (int i = 0; i < s->img_n; ++i) {
+        if (z->img_comp[i].h > h_max) h_max = z->img_comp[i].h;
+        if (z->img_comp[i].v > v_max) v_max = z->img_comp[i].v;
+    }
+    for (int i = 0; i < s->img_n; ++i) {
+        if (h_max % z->img_comp[i].h != 0 || v_max % z->img_comp[i].v != 0) {
+            return stbi__err("bad H", "Corrupt JPEG");
+        }
+    }
+    z->img_h_max = h_max;
+    z->img_v_max = v_max;
+    z->img_mcu_w = h_max * 8;
+    z->img_mcu_h = v_max * 8;
+    z->img_mcu_x = (s->img_x + z->img_mcu_w - 1) / z->img_mcu_w;
+    z->img_mcu_y = (s->img_y + z->img_mcu_h - 1) / z->img_mcu_h;
+    for (int i = 0; i < s->img_n; ++i) {
+        z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max - 1) / h_max;
+        z->img_comp[i].y = (s->img_y * z->img_comp[i].v + v_max - 1) / v_max;
+        z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
+        z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
+        z->img_comp[i].raw_data = NULL;
+        z->img_comp[i].raw_coeff = NULL;
+        z->img_comp[i].data = NULL;
+        z->img_comp[i].coeff = NULL;
+        z->img_comp[i].linebuf = NULL;
+    }
+    return 1;
+}
+
+// Decodes the scan holding Y one strip of blocks at a time, handing each
+// finished scanline to sink.row() before the next strip overwrites it.
+template <class Sink>
+static int jpeg_stream_scan(stbi__jpeg* z, const JpegLumaScale& scale, Sink& sink) {
+    const bool interleaved = z->scan_n > 1;
+    const int strip_rows = (interleaved ? z->img_mcu_h : 8) / scale.reduce;
+    const int strips = interleaved ? z->img_mcu_y : (z->img_comp[0].y + 7) >> 3;
+    const int strip_blocks = interleaved ? z->img_mcu_x : (z->img_comp[0].x + 7) >> 3;
+    int width, height;
+    jpeg_luma_size(z, scale, &width, &height);
+    std::vector<stbi_uc> strip(static_cast<size_t>(scale.stride) * strip_rows + 15);
+    stbi_uc* rows = (stbi_uc*) (((size_t) strip.data() + 15) & ~(size_t) 15);
+
+    STBI_SIMD_ALIGN(short, data[64]);
+    bool decoding = true;
+    stbi__jpeg_reset(z);
+    for (int j = 0; j < strips; ++j) {
+        if (!decoding && j > 0) {
+            // the data ran out early: keep rows coming so the output keeps its shape
+            memset(strip.data(), 0, strip.size());
+        }
+        for (int i = 0; decoding && i < strip_blocks; ++i) {
+            for (int k = 0; k < z->scan_n; ++k) {
+                int n = z->order[k];
+                int h = interleaved ? z->img_comp[n].h : 1;
+                int v = interleaved ? z->img_comp[n].v : 1;
+                for (int y = 0; y < v; ++y) {
+                    for (int x = 0; x < h; ++x) {
+                        int ha = z->img_comp[n].ha;
+                        if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq])) return 0;
+                        if (n == 0) {
+                            scale.idct(rows + scale.stride * y * scale.block + (i * h + x) * scale.block, scale.stride, data);
+                        }
+                    }
+                }
+            }
+            if (--z->todo <= 0) {
+                if (z->code_bits < 24) stbi__grow_buffer_unsafe(z);
+                if (!STBI__RESTART(z->marker)) {
+                    // blocks this strip never reached still hold the strip before's pixels
+                    int done = (i + 1) * (interleaved ? z->img_comp[0].h : 1) * scale.block;
+                    for (int r = 0; r < strip_rows; ++r) {
+                        memset(rows + static_cast<size_t>(scale.stride) * r + done, 0, scale.stride - done);
+                    }
+                    decoding = false;
+                    break;
+                }
+                stbi__jpeg_reset(z);
+            }
+        }
+        for (int r = 0; r < strip_rows; ++r) {
+            int row = j * strip_rows + r;
+            if (row >= height) {
+                break;
+            }
+            sink.row(rows + static_cast<size_t>(scale.stride) * r);
+        }
+    }
+    return 1;
+}
+
+// Streams the Y plane of a baseline JPEG straight into sink: sink.start(width,
+// height, reduce) once, then sink.row(luma) per scanline, top to bottom. Never
+// holds more than one MCU row of pixels. Progressive files cannot be streamed (every
+// scan touches every block) and, like the formats jpeg_decode_luma turns
+// down, come back with `unsupported` set before sink sees anything.
+template <class Sink>
+static int jpeg_stream_luma(stbi__jpeg* z, int reduce, Sink& sink, bool* unsupported) {
+    *unsupported = false;
+    z->restart_interval = 0;
+    if (!stbi__decode_jpeg_header(z, STBI__SCAN_header) || !jpeg_stream_layout(z)) {
+        return 0;
+    }
+    if (z->progressive || !jpeg_luma_supported(z)) {
+        *unsupported = true;
+        return 0;
+    }
+    JpegLumaScale scale = jpeg_luma_scale(z, reduce);
+    int width, height;
+    jpeg_luma_size(z, scale, &width, &height);
+    sink.start(width, height, scale.reduce);
+
+    int m = stbi__get_marker(z);
+    while (!stbi__EOI(m)) {
+        if (stbi__SOS(m)) {
+            if (!stbi__process_scan_header(z)) {
+                return 0;
+            }
+            bool has_luma = false;
+            for (int k = 0; k < z->scan_n; k++) {
+                has_luma = has_luma || z->order[k] == 0;
+            }
+            if (has_luma) {
+                // everything after the Y scan is chroma, so we are done
+                return jpeg_stream_scan(z, scale, sink);
+            }
+            jpeg_luma_skip_scan(z);
+            m = stbi__get_marker(z);
+        } else {
+            if (!stbi__process_marker(z, m)) {
+                return 0;
+            }
+            m = stbi__get_marker(z);
+        }
+    }
+    return stbi__err("no Y scan", "Corrupt JPEG");
+}
+
+static stbi__jpeg* jpeg_create(stbi__context* s) {
+    stbi__jpeg* z = (stbi__jpeg*) stbi__malloc(sizeof(stbi__jpeg));
+    if (z != nullptr) {
+        memset(z, 0, sizeof(stbi__jpeg));
+        z->s = s;
+        stbi__setup_jpeg(z);
+    }
+    return z;
+}
+
+// Decodes a single-channel luminance plane. JPEGs go through the Y-only
+// decoder and PNGs through png_stream.h; anything else is handed to
+// stb_image's own gray conversion.
+// `reduce` is the largest size reduction (1, 2, 4 or 8) the caller can use and
+// comes back as the one applied; only JPEGs are ever reduced. A pool lets
+// baseline JPEGs with restart markers decode on several threads. format, if
+// known, saves looking at the magic bytes.
+inline bool decode_image_luma(ImageBuffer& plane, const unsigned char* bytes, int len, int& reduce,
+                              ThreadPool* pool = nullptr, ImageFormat format = ImageFormat::Unknown) {
+    int x, y;
+    int requested = reduce;
+    stbi_uc* data = nullptr;
+    bool unsupported = true;
+    if (format == ImageFormat::Unknown) {
+        format = sniff_image_format(bytes, static_cast<size_t>(len));
+    }
+    reduce = 1;
+    if (format == ImageFormat::Jpeg) {
+        stbi__context s;
+        stbi__start_mem(&s, bytes, len);
+        stbi__jpeg* j = jpeg_create(&s);
+        if (j != nullptr) {
+            reduce = requested;
+            data = jpeg_decode_luma(j, pool, &reduce, &x, &y, &unsupported);
+            STBI_FREE(j);
+        }
+    } else if (format == ImageFormat::Png) {
+        data = png_decode_luma(bytes, static_cast<size_t>(len), &x, &y, &unsupported);
+    }
+    if (data == nullptr && unsupported) {
+        int n;
+        reduce = 1;
+        data = image_load_from_memory(bytes, len, &x, &y, &n, 1, format);
+    }
+
+    if (data != nullptr) {
+        plane = ImageBuffer(data, stbi_image_free, x, y, 1);
+    }
+    return (data != nullptr);
+}
+
+inline bool load_image_luma(ImageBuffer& plane, const std::string& filename, int& reduce,
+                            ThreadPool* pool = nullptr, ImageFormat format = ImageFormat::Unknown) {
+    MappedFile file;
+    if (!file.open(filename) || file.size() > INT_MAX) {
+        return false;
+    }
+    return decode_image_luma(plane, file.data(), static_cast<int>(file.size()), reduce, pool, format);
+}
+
+// Feeds the luminance of an encoded image to sink scanline by scanline, as
+// jpeg_stream_luma and png_stream_luma do. Inputs that cannot be streamed are
+// decoded whole first and then replayed row by row, so sink sees the same
+// thing either way.
+template <class Sink>
+inline bool stream_image_luma(const unsigned char* bytes, int len, int reduce, Sink& sink,
+                              ImageFormat format = ImageFormat::Unknown) {
+    bool unsupported = true;
+    if (format == ImageFormat::Unknown) {
+        format = sniff_image_format(bytes, static_cast<size_t>(len));
+    }
+    if (format == ImageFormat::Jpeg) {
+        stbi__context s;
+        stbi__start_mem(&s, bytes, len);
+        stbi__jpeg* j = jpeg_create(&s);
+        if (j != nullptr) {
+            int ok = jpeg_stream_luma(j, reduce, sink, &unsupported);
+            STBI_FREE(j);
+            if (!unsupported) {
+                return ok != 0;
+            }
+        }
+    } else if (format == ImageFormat::Png) {
+        int ok = png_stream_luma(bytes, static_cast<size_t>(len), sink, &unsupported);
+        if (!unsupported) {
+            return ok != 0;
+        }
+    }
+
+    ImageBuffer plane;
+    if (!decode_image_luma(plane, bytes, len, reduce, nullptr, format)) {
+        return false;
+    }
+    ImageView view = plane.view();
+    sink.start(view.width, view.height, reduce);
+    for (int i = 0; i < view.height; i++) {
+        sink.row(view.row(i));
+    }
+    return true;
+}
+
+#endif
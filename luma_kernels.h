@@ -0,0 +1,346 @@
+/**
+ * @brief RGBA to luminance row kernels, picked once at startup by cpuid
+ *
+ * The row kernels turn a run of RGBA pixels into (r + g + b) / 3 bytes, the
+ * same integers the original per-pixel average produced. The divide by 3 is done as
+ * (n * 0xAAAB) >> 17, which is exact for every n below 2^16. The weighted
+ * kernels apply fixed-point channel weights, so a multiply-add and a shift
+ * replace the divide; the linear kernels do the same on linear-light values
+ * looked up from, and re-encoded through, sRGB tables.
+ */
+
+#ifndef LUMA_KERNELS_H
+#define LUMA_KERNELS_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define LUMA_KERNELS_X86 1
+    #include <cpuid.h>
+    #include <immintrin.h>
+#endif
+
+// Weights for the first, second and third byte of a pixel. They sum to 256,
+// or to 65536 for the linear kernels, which have the headroom for it.
+struct LumaWeights {
+    int r;
+    int g;
+    int b;
+};
+
+typedef void (*LumaRowKernel)(const unsigned char* rgba, unsigned char* luma, size_t count);
+typedef void (*LumaWeightedRowKernel)(const unsigned char* rgba, unsigned char* luma, size_t count, const LumaWeights& weights);
+
+inline void luma_row_scalar(const unsigned char* rgba, unsigned char* luma, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char* pixel = rgba + 4 * i;
+        luma[i] = static_cast<unsigned char>((pixel[0] + pixel[1] + pixel[2]) / 3);
+    }
+}
+
+inline void luma_weighted_row_scalar(const unsigned char* rgba, unsigned char* luma, size_t count, const LumaWeights& weights) {
+    for (size_t i = 0; i < count; i++) {
+        const unsigned char* pixel = rgba + 4 * i;
+        luma[i] = static_cast<unsigned char>((pixel[0] * weights.r + pixel[1] * weights.g + pixel[2] * weights.b) >> 8);
+    }
+}
+
+// sRGB bytes to 14-bit linear light and back. Gray survives the round trip
+// unchanged. to_linear is 32 bits wide so it can be gathered directly;
+// from_linear stays bytes to keep it in L1, with three bytes of slack so a
+// 32-bit gather at its last entry stays inside.
+struct SrgbTables {
+    static const int linear_levels = 16384;
+
+    int32_t to_linear[256];
+    unsigned char from_linear[linear_levels + 3];
+
+    SrgbTables() {
+        const double top = linear_levels - 1;
+        for (int i = 0; i < 256; i++) {
+            double v = i / 255.0;
+            double linear = v <= 0.04045 ? v / 12.92 : std::pow((v + 0.055) / 1.055, 2.4);
+            to_linear[i] = static_cast<int32_t>(std::lround(linear * top));
+        }
+        for (int i = 0; i < linear_levels; i++) {
+            double linear = i / top;
+            double v = linear <= 0.0031308 ? linear * 12.92 : 1.055 * std::pow(linear, 1 / 2.4) - 0.055;
+            from_linear[i] = static_cast<unsigned char>(std::lround(v * 255));
+        }
+        from_linear[linear_levels] = from_linear[linear_levels + 1] = from_linear[linear_levels + 2] = 0;
+    }
+};
+
+inline const SrgbTables& srgb_tables() {
+    static const SrgbTables tables;
+    return tables;
+}
+
+inline unsigned char linear_luma(const SrgbTables& srgb, const unsigned char* pixel, const LumaWeights& weights) {
+    int linear = (srgb.to_linear[pixel[0]] * weights.r + srgb.to_linear[pixel[1]] * weights.g +
+                  srgb.to_linear[pixel[2]] * weights.b) >> 16;
+    return srgb.from_linear[linear];
+}
+
+inline void luma_linear_row_scalar(const unsigned char* rgba, unsigned char* luma, size_t count, const LumaWeights& weights) {
+    const SrgbTables& srgb = srgb_tables();
+    for (size_t i = 0; i < count; i++) {
+        luma[i] = linear_luma(srgb, rgba + 4 * i, weights);
+    }
+}
+
+#ifdef LUMA_KERNELS_X86
+
+__attribute__((target("sse2")))
+inline __m128i luma_sum_4_sse2(__m128i pixels) {
+    const __m128i low_byte = _mm_set1_epi32(0xFF);
+    __m128i r = _mm_and_si128(pixels, low_byte);
+    __m128i g = _mm_and_si128(_mm_srli_epi32(pixels, 8), low_byte);
+    __m128i b = _mm_and_si128(_mm_srli_epi32(pixels, 16), low_byte);
+    return _mm_add_epi32(_mm_add_epi32(r, g), b);
+}
+
+__attribute__((target("sse2")))
+inline void luma_row_sse2(const unsigned char* rgba, unsigned char* luma, size_t count) {
+    const __m128i third = _mm_set1_epi16(static_cast<short>(0xAAAB));
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i* src = reinterpret_cast<const __m128i*>(rgba + 4 * i);
+        __m128i s0 = luma_sum_4_sse2(_mm_loadu_si128(src + 0));
+        __m128i s1 = luma_sum_4_sse2(_mm_loadu_si128(src + 1));
+        __m128i s2 = luma_sum_4_sse2(_mm_loadu_si128(src + 2));
+        __m128i s3 = luma_sum_4_sse2(_mm_loadu_si128(src + 3));
+        __m128i lo = _mm_srli_epi16(_mm_mulhi_epu16(_mm_packs_epi32(s0, s1), third), 1);
+        __m128i hi = _mm_srli_epi16(_mm_mulhi_epu16(_mm_packs_epi32(s2, s3), third), 1);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(luma + i), _mm_packus_epi16(lo, hi));
+    }
+    luma_row_scalar(rgba + 4 * i, luma + i, count - i);
+}
+
+// Bytes 0 and 2 of each pixel pair up with their weights in one madd, byte 1
+// in another; byte 3 meets a zero weight.
+__attribute__((target("sse2")))
+inline __m128i luma_weighted_4_sse2(__m128i pixels, __m128i rb_weights, __m128i g_weight) {
+    const __m128i even_bytes = _mm_set1_epi16(0xFF);
+    __m128i rb = _mm_madd_epi16(_mm_and_si128(pixels, even_bytes), rb_weights);
+    __m128i g = _mm_madd_epi16(_mm_srli_epi16(pixels, 8), g_weight);
+    return _mm_srli_epi32(_mm_add_epi32(rb, g), 8);
+}
+
+__attribute__((target("sse2")))
+inline void luma_weighted_row_sse2(const unsigned char* rgba, unsigned char* luma, size_t count, const LumaWeights& weights) {
+    const __m128i rb_weights = _mm_set1_epi32(weights.r | (weights.b << 16));
+    const __m128i g_weight = _mm_set1_epi32(weights.g);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        const __m128i* src = reinterpret_cast<const __m128i*>(rgba + 4 * i);
+        __m128i y0 = luma_weighted_4_sse2(_mm_loadu_si128(src + 0), rb_weights, g_weight);
+        __m128i y1 = luma_weighted_4_sse2(_mm_loadu_si128(src + 1), rb_weights, g_weight);
+        __m128i y2 = luma_weighted_4_sse2(_mm_loadu_si128(src + 2), rb_weights, g_weight);
+        __m128i y3 = luma_weighted_4_sse2(_mm_loadu_si128(src + 3), rb_weights, g_weight);
+        __m128i packed = _mm_packus_epi16(_mm_packs_epi32(y0, y1), _mm_packs_epi32(y2, y3));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(luma + i), packed);
+    }
+    luma_weighted_row_scalar(rgba + 4 * i, luma + i, count - i, weights);
+}
+
+__attribute__((target("avx2")))
+inline __m256i luma_sum_8_avx2(__m256i pixels) {
+    const __m256i low_byte = _mm256_set1_epi32(0xFF);
+    __m256i r = _mm256_and_si256(pixels, low_byte);
+    __m256i g = _mm256_and_si256(_mm256_srli_epi32(pixels, 8), low_byte);
+    __m256i b = _mm256_and_si256(_mm256_srli_epi32(pixels, 16), low_byte);
+    return _mm256_add_epi32(_mm256_add_epi32(r, g), b);
+}
+
+__attribute__((target("avx2")))
+inline void luma_row_avx2(const unsigned char* rgba, unsigned char* luma, size_t count) {
+    const __m256i third = _mm256_set1_epi16(static_cast<short>(0xAAAB));
+    // packs/packus work per 128-bit lane, this puts the 4-pixel groups back in order
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const __m256i* src = reinterpret_cast<const __m256i*>(rgba + 4 * i);
+        __m256i s0 = luma_sum_8_avx2(_mm256_loadu_si256(src + 0));
+        __m256i s1 = luma_sum_8_avx2(_mm256_loadu_si256(src + 1));
+        __m256i s2 = luma_sum_8_avx2(_mm256_loadu_si256(src + 2));
+        __m256i s3 = luma_sum_8_avx2(_mm256_loadu_si256(src + 3));
+        __m256i lo = _mm256_srli_epi16(_mm256_mulhi_epu16(_mm256_packs_epi32(s0, s1), third), 1);
+        __m256i hi = _mm256_srli_epi16(_mm256_mulhi_epu16(_mm256_packs_epi32(s2, s3), third), 1);
+        __m256i packed = _mm256_permutevar8x32_epi32(_mm256_packus_epi16(lo, hi), order);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(luma + i), packed);
+    }
+    luma_row_sse2(rgba + 4 * i, luma + i, count - i);
+}
+
+__attribute__((target("avx2")))
+inline __m256i luma_weighted_8_avx2(__m256i pixels, __m256i rb_weights, __m256i g_weight) {
+    const __m256i even_bytes = _mm256_set1_epi16(0xFF);
+    __m256i rb = _mm256_madd_epi16(_mm256_and_si256(pixels, even_bytes), rb_weights);
+    __m256i g = _mm256_madd_epi16(_mm256_srli_epi16(pixels, 8), g_weight);
+    return _mm256_srli_epi32(_mm256_add_epi32(rb, g), 8);
+}
+
+// Packs four vectors of 8 per-pixel results, each below 256, into 32 bytes in pixel order.
+__attribute__((target("avx2")))
+inline __m256i luma_pack_32_avx2(__m256i y0, __m256i y1, __m256i y2, __m256i y3) {
+    const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+    __m256i packed = _mm256_packus_epi16(_mm256_packs_epi32(y0, y1), _mm256_packs_epi32(y2, y3));
+    return _mm256_permutevar8x32_epi32(packed, order);
+}
+
+__attribute__((target("avx2")))
+inline void luma_weighted_row_avx2(const unsigned char* rgba, unsigned char* luma, size_t count, const LumaWeights& weights) {
+    const __m256i rb_weights = _mm256_set1_epi32(weights.r | (weights.b << 16));
+    const __m256i g_weight = _mm256_set1_epi32(weights.g);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const __m256i* src = reinterpret_cast<const __m256i*>(rgba + 4 * i);
+        __m256i y0 = luma_weighted_8_avx2(_mm256_loadu_si256(src + 0), rb_weights, g_weight);
+        __m256i y1 = luma_weighted_8_avx2(_mm256_loadu_si256(src + 1), rb_weights, g_weight);
+        __m256i y2 = luma_weighted_8_avx2(_mm256_loadu_si256(src + 2), rb_weights, g_weight);
+        __m256i y3 = luma_weighted_8_avx2(_mm256_loadu_si256(src + 3), rb_weights, g_weight);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(luma + i), luma_pack_32_avx2(y0, y1, y2, y3));
+    }
+    luma_weighted_row_sse2(rgba + 4 * i, luma + i, count - i, weights);
+}
+
+// Three gathers into the linear table, the weighted sum, one gather back out.
+__attribute__((target("avx2")))
+inline __m256i luma_linear_8_avx2(__m256i pixels, const SrgbTables& srgb, __m256i r_weight, __m256i g_weight, __m256i b_weight) {
+    const __m256i low_byte = _mm256_set1_epi32(0xFF);
+    __m256i r = _mm256_i32gather_epi32(srgb.to_linear, _mm256_and_si256(pixels, low_byte), 4);
+    __m256i g = _mm256_i32gather_epi32(srgb.to_linear, _mm256_and_si256(_mm256_srli_epi32(pixels, 8), low_byte), 4);
+    __m256i b = _mm256_i32gather_epi32(srgb.to_linear, _mm256_and_si256(_mm256_srli_epi32(pixels, 16), low_byte), 4);
+    __m256i linear = _mm256_add_epi32(_mm256_add_epi32(_mm256_mullo_epi32(r, r_weight), _mm256_mullo_epi32(g, g_weight)),
+                                      _mm256_mullo_epi32(b, b_weight));
+    __m256i encoded = _mm256_i32gather_epi32(reinterpret_cast<const int*>(srgb.from_linear), _mm256_srli_epi32(linear, 16), 1);
+    return _mm256_and_si256(encoded, low_byte);
+}
+
+__attribute__((target("avx2")))
+inline void luma_linear_row_avx2(const unsigned char* rgba, unsigned char* luma, size_t count, const LumaWeights& weights) {
+    const SrgbTables& srgb = srgb_tables();
+    const __m256i r_weight = _mm256_set1_epi32(weights.r);
+    const __m256i g_weight = _mm256_set1_epi32(weights.g);
+    const __m256i b_weight = _mm256_set1_epi32(weights.b);
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        const __m256i* src = reinterpret_cast<const __m256i*>(rgba + 4 * i);
+        __m256i y0 = luma_linear_8_avx2(_mm256_loadu_si256(src + 0), srgb, r_weight, g_weight, b_weight);
+        __m256i y1 = luma_linear_8_avx2(_mm256_loadu_si256(src + 1), srgb, r_weight, g_weight, b_weight);
+        __m256i y2 = luma_linear_8_avx2(_mm256_loadu_si256(src + 2), srgb, r_weight, g_weight, b_weight);
+        __m256i y3 = luma_linear_8_avx2(_mm256_loadu_si256(src + 3), srgb, r_weight, g_weight, b_weight);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(luma + i), luma_pack_32_avx2(y0, y1, y2, y3));
+    }
+    luma_linear_row_scalar(rgba + 4 * i, luma + i, count - i, weights);
+}
+
+// GCC 12 flags the _mm512_undefined_epi32() inside its own intrinsics
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+__attribute__((target("avx512f,avx512bw")))
+inline __m512i luma_sum_16_avx512(__m512i pixels) {
+    const __m512i low_byte = _mm512_set1_epi32(0xFF);
+    __m512i r = _mm512_and_si512(pixels, low_byte);
+    __m512i g = _mm512_and_si512(_mm512_srli_epi32(pixels, 8), low_byte);
+    __m512i b = _mm512_and_si512(_mm512_srli_epi32(pixels, 16), low_byte);
+    return _mm512_add_epi32(_mm512_add_epi32(r, g), b);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline void luma_row_avx512(const unsigned char* rgba, unsigned char* luma, size_t count) {
+    const __m512i third = _mm512_set1_epi16(static_cast<short>(0xAAAB));
+    const __m512i order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64) {
+        const unsigned char* src = rgba + 4 * i;
+        __m512i s0 = luma_sum_16_avx512(_mm512_loadu_si512(src + 0));
+        __m512i s1 = luma_sum_16_avx512(_mm512_loadu_si512(src + 64));
+        __m512i s2 = luma_sum_16_avx512(_mm512_loadu_si512(src + 128));
+        __m512i s3 = luma_sum_16_avx512(_mm512_loadu_si512(src + 192));
+        __m512i lo = _mm512_srli_epi16(_mm512_mulhi_epu16(_mm512_packs_epi32(s0, s1), third), 1);
+        __m512i hi = _mm512_srli_epi16(_mm512_mulhi_epu16(_mm512_packs_epi32(s2, s3), third), 1);
+        __m512i packed = _mm512_permutexvar_epi32(order, _mm512_packus_epi16(lo, hi));
+        _mm512_storeu_si512(luma + i, packed);
+    }
+    luma_row_avx2(rgba + 4 * i, luma + i, count - i);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline __m512i luma_weighted_16_avx512(__m512i pixels, __m512i rb_weights, __m512i g_weight) {
+    const __m512i even_bytes = _mm512_set1_epi16(0xFF);
+    __m512i rb = _mm512_madd_epi16(_mm512_and_si512(pixels, even_bytes), rb_weights);
+    __m512i g = _mm512_madd_epi16(_mm512_srli_epi16(pixels, 8), g_weight);
+    return _mm512_srli_epi32(_mm512_add_epi32(rb, g), 8);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+inline void luma_weighted_row_avx512(const unsigned char* rgba, unsigned char* luma, size_t count, const LumaWeights& weights) {
+    const __m512i rb_weights = _mm512_set1_epi32(weights.r | (weights.b << 16));
+    const __m512i g_weight = _mm512_set1_epi32(weights.g);
+    const __m512i order = _mm512_setr_epi32(0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15);
+    size_t i = 0;
+    for (; i + 64 <= count; i += 64) {
+        const unsigned char* src = rgba + 4 * i;
+        __m512i y0 = luma_weighted_16_avx512(_mm512_loadu_si512(src + 0), rb_weights, g_weight);
+        __m512i y1 = luma_weighted_16_avx512(_mm512_loadu_si512(src + 64), rb_weights, g_weight);
+        __m512i y2 = luma_weighted_16_avx512(_mm512_loadu_si512(src + 128), rb_weights, g_weight);
+        __m512i y3 = luma_weighted_16_avx512(_mm512_loadu_si512(src + 192), rb_weights, g_weight);
+        __m512i packed = _mm512_packus_epi16(_mm512_packs_epi32(y0, y1), _mm512_packs_epi32(y2, y3));
+        _mm512_storeu_si512(luma + i, _mm512_permutexvar_epi32(order, packed));
+    }
+    luma_weighted_row_avx2(rgba + 4 * i, luma + i, count - i, weights);
+}
+
+#pragma GCC diagnostic pop
+
+// The OS has to save the wider registers too, cpuid alone is not enough.
+inline bool os_saves_xstate(unsigned int mask) {
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & bit_OSXSAVE)) {
+        return false;
+    }
+    unsigned int xcr0_lo, xcr0_hi;
+    __asm__ volatile("xgetbv" : "=a"(xcr0_lo), "=d"(xcr0_hi) : "c"(0));
+    return (xcr0_lo & mask) == mask;
+}
+
+#endif
+
+struct LumaKernelInfo {
+    LumaRowKernel row;
+    LumaWeightedRowKernel weighted;
+    LumaWeightedRowKernel linear;
+    const char* name;
+};
+
+inline LumaKernelInfo select_luma_kernel() {
+#ifdef LUMA_KERNELS_X86
+    unsigned int eax, ebx, ecx, edx;
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+        const unsigned int ymm_state = 0x6;
+        const unsigned int zmm_state = 0xE6;
+        if ((ebx & bit_AVX512F) && (ebx & bit_AVX512BW) && os_saves_xstate(zmm_state)) {
+            return {luma_row_avx512, luma_weighted_row_avx512, luma_linear_row_avx2, "avx512bw"};
+        }
+        if ((ebx & bit_AVX2) && os_saves_xstate(ymm_state)) {
+            return {luma_row_avx2, luma_weighted_row_avx2, luma_linear_row_avx2, "avx2"};
+        }
+    }
+    if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & bit_SSE2)) {
+        return {luma_row_sse2, luma_weighted_row_sse2, luma_linear_row_scalar, "sse2"};
+    }
+#endif
+    return {luma_row_scalar, luma_weighted_row_scalar, luma_linear_row_scalar, "scalar"};
+}
+
+inline const LumaKernelInfo& luma_kernel() {
+    static const LumaKernelInfo kernel = select_luma_kernel();
+    return kernel;
+}
+
+#endif
@@ -0,0 +1,183 @@
+/**
+ * @brief Single-channel luminance plane every renderer works from
+ *
+ * Interleaved pixels are reduced to one luminance byte each exactly once, by
+ * the vectorized row kernel for the chosen model (the (r + g + b) / 3 mean
+ * unless told otherwise), and everything downstream reads those
+ * bytes instead of going back to the RGBA. Rows start on 64-byte boundaries
+ * and the padding past each row is zeroed, so SIMD code may read a whole
+ * vector at the end of a row.
+ */
+
+#ifndef LUMA_PLANE_H
+#define LUMA_PLANE_H
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "image_buffer.h"
+#include "luma_kernels.h"
+
+enum class LumaModel {
+    Mean,    // (r + g + b) / 3, what the renderer has always used
+    Rec601,  // 0.299 r + 0.587 g + 0.114 b, the weights stb_image and JPEG use
+    Rec709,  // 0.2126 r + 0.7152 g + 0.0722 b
+    Linear,  // Rec.709 weights applied in linear light, re-encoded as sRGB
+};
+
+// Accepts "mean", "rec601", "rec709" and "linear". Returns false for anything else.
+inline bool parse_luma_model(const std::string& name, LumaModel& model) {
+    static const struct {
+        const char* name;
+        LumaModel model;
+    } names[] = {
+        {"mean", LumaModel::Mean}, {"rec601", LumaModel::Rec601}, {"rec709", LumaModel::Rec709}, {"linear", LumaModel::Linear},
+    };
+    for (const auto& entry : names) {
+        if (name == entry.name) {
+            model = entry.model;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Fixed-point weights for a model, in the pixel's own byte order.
+inline LumaWeights luma_model_weights(LumaModel model, bool bgr) {
+    LumaWeights weights = {54, 183, 19};
+    if (model == LumaModel::Rec601) {
+        weights = {77, 150, 29};
+    } else if (model == LumaModel::Linear) {
+        weights = {13933, 46871, 4732};
+    }
+    if (bgr) {
+        std::swap(weights.r, weights.b);
+    }
+    return weights;
+}
+
+// Reduces `width` interleaved pixels to luminance bytes. bgr says the first
+// byte of a pixel is blue, which only matters to the weighted models. Gray
+// comes through every model unchanged.
+inline void luma_row(const unsigned char* pixels, int channels, unsigned char* luma, int width,
+                     LumaModel model = LumaModel::Mean, bool bgr = false) {
+    const size_t count = static_cast<size_t>(width);
+    if (channels < 3) {
+        if (channels == 1) {
+            memcpy(luma, pixels, count);
+            return;
+        }
+        for (size_t j = 0; j < count; j++) {
+            luma[j] = pixels[j * channels];
+        }
+        return;
+    }
+
+    const LumaWeights weights = luma_model_weights(model, bgr);
+    if (channels == 4) {
+        switch (model) {
+            case LumaModel::Mean: luma_kernel().row(pixels, luma, count); break;
+            case LumaModel::Linear: luma_kernel().linear(pixels, luma, count, weights); break;
+            default: luma_kernel().weighted(pixels, luma, count, weights); break;
+        }
+        return;
+    }
+
+    // packed rgb (or bgr) straight out of an uncompressed file
+    if (model == LumaModel::Mean) {
+        for (size_t j = 0; j < count; j++) {
+            const unsigned char* pixel = pixels + 3 * j;
+            luma[j] = static_cast<unsigned char>((pixel[0] + pixel[1] + pixel[2]) / 3);
+        }
+    } else if (model == LumaModel::Linear) {
+        const SrgbTables& srgb = srgb_tables();
+        for (size_t j = 0; j < count; j++) {
+            luma[j] = linear_luma(srgb, pixels + 3 * j, weights);
+        }
+    } else {
+        for (size_t j = 0; j < count; j++) {
+            const unsigned char* pixel = pixels + 3 * j;
+            luma[j] = static_cast<unsigned char>((pixel[0] * weights.r + pixel[1] * weights.g + pixel[2] * weights.b) >> 8);
+        }
+    }
+}
+
+class LumaPlane {
+public:
+    static const size_t alignment = 64;
+
+    LumaPlane() : rows_(nullptr), width_(0), height_(0), stride_(0), capacity_(0) {}
+
+    explicit LumaPlane(const ImageView& image, LumaModel model = LumaModel::Mean) : LumaPlane() {
+        build(image, model);
+    }
+
+    LumaPlane(LumaPlane&&) = default;
+    LumaPlane& operator=(LumaPlane&&) = default;
+
+    // Returns false, leaving the plane empty, if the memory is not there.
+    // A plane that is rebuilt keeps its allocation when the new image fits.
+    bool build(const ImageView& image, LumaModel model = LumaModel::Mean) {
+        const size_t stride = (static_cast<size_t>(image.width) + alignment - 1) & ~(alignment - 1);
+        const size_t bytes = stride * static_cast<size_t>(image.height);
+        if (pixels_ == nullptr || bytes == 0 || bytes > capacity_) {
+            pixels_.reset(bytes != 0 ? static_cast<unsigned char*>(aligned_alloc(alignment, bytes)) : nullptr);
+            capacity_ = pixels_ != nullptr ? bytes : 0;
+        }
+        rows_ = pixels_.get();
+        if (pixels_ == nullptr) {
+            width_ = height_ = 0;
+            stride_ = 0;
+            return false;
+        }
+        width_ = image.width;
+        height_ = image.height;
+        stride_ = stride;
+
+        for (int i = 0; i < height_; i++) {
+            unsigned char* luma = pixels_.get() + stride_ * static_cast<size_t>(i);
+            luma_row(image.row(i), image.channels, luma, width_, model, image.bgr);
+            memset(luma + width_, 0, stride_ - static_cast<size_t>(width_));
+        }
+        return true;
+    }
+
+    // Reads a top-down single-channel image where it lies instead of copying
+    // it; the image has to outlive the plane's use. Rows are then neither
+    // aligned nor padded. False, leaving the plane alone, for anything else.
+    bool borrow(const ImageView& image) {
+        if (image.channels != 1 || image.stride <= 0 || image.empty()) {
+            return false;
+        }
+        rows_ = image.pixels;
+        width_ = image.width;
+        height_ = image.height;
+        stride_ = static_cast<size_t>(image.stride);
+        return true;
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    size_t stride() const { return stride_; }
+    bool empty() const { return rows_ == nullptr; }
+
+    const unsigned char* row(int i) const { return rows_ + stride_ * static_cast<size_t>(i); }
+
+private:
+    struct Free {
+        void operator()(unsigned char* pixels) const { free(pixels); }
+    };
+
+    std::unique_ptr<unsigned char, Free> pixels_;
+    const unsigned char* rows_;  // pixels_, or a borrowed image
+    int width_;
+    int height_;
+    size_t stride_;
+    size_t capacity_;
+};
+
+#endif
@@ -7,128 +7,1252 @@
 #include <iostream>
 #include <vector>
 #include <fstream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <future>
+#include <thread>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <numeric>
+#include <string>
+#include <cstring>
+#include <csignal>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
 
 extern "C" {
     #define STB_IMAGE_IMPLEMENTATION
     #include "stb_image.h"
 }
 
+#include "ascii_writer.h"
+#include "block_rows.h"
+#include "image_buffer.h"
+#include "frame_pipeline.h"
+#include "frame_stream.h"
+#include "glyph_table.h"
+#include "image_format.h"
+#include "jpeg_luma.h"
+#include "mapped_file.h"
+#include "raw_image.h"
+#include "render_protocol.h"
+#include "scale_kernels.h"
+#include "shared_frames.h"
+#include "terminal_diff.h"
+#include "luma_plane.h"
+#include "luma_table.h"
+#include "thread_pool.h"
+
 using namespace std;
 
-bool load_image(vector<unsigned char>& image, const string& filename, int& x, int&y) {
-    int n;
-    unsigned char* data = stbi_load(filename.c_str(), &x, &y, &n, 4);
-    if (data != nullptr) {
-        image = vector<unsigned char>(data, data + x * y * 4);
+// Uncompressed PPM/PGM/BMP/TGA bytes are used where they lie; anything else
+// is decoded into image. view is only good while bytes and image are alive.
+bool load_image(const unsigned char* bytes, size_t size, ImageBuffer& image, ImageView& view, ImageFormat format = ImageFormat::Unknown) {
+    if (raw_image_view(bytes, size, view, format)) {
+        return true;
+    }
+    if (size > INT_MAX) {
+        return false;
+    }
+    int x, y, n;
+    unsigned char* data = image_load_from_memory(bytes, static_cast<int>(size), &x, &y, &n, 4, format);
+    if (data == nullptr) {
+        return false;
     }
-    stbi_image_free(data);
-    return (data != nullptr);
+    image = ImageBuffer(data, stbi_image_free, x, y, 4);
+    view = image.view();
+    return true;
 }
 
-int avg_lumenance(const vector<unsigned char> & image, const int & width, const int & scalar, const int & x_pos, const int & y_pos) {
+// Same for a file, which stays mapped in file for as long as view is used.
+bool load_image(MappedFile& file, ImageBuffer& image, ImageView& view, const string& filename, ImageFormat format = ImageFormat::Unknown) {
+    return file.open(filename) && load_image(file.data(), file.size(), image, view, format);
+}
 
-    const size_t RGBA = 4;
-    int r, g, b;
-    int avg_lumen = 0;
+// Fills rows [row_begin, row_end) of a frame whose rows are all 2 * end_width + 1 bytes,
+// newline included; out points at the first byte of row_begin. Each source row is read
+// once, left to right, into a row of block sums that is turned into text every scalar rows.
+void render_rows(const LumaPlane & plane, 
+                 const int & scalar, 
+                 const GlyphTable & glyphs, 
+                 const int & row_begin, 
+                 const int & row_end, 
+                 char * out) {
 
-    for (int i = (y_pos * scalar); i < (scalar * (y_pos + 1)); i++) {
-        for (int j = (x_pos * scalar); j < (scalar * (x_pos + 1)); j++) {
-            size_t index = RGBA * (i * width + j);
-            r = static_cast<int>(image[index + 0]);
-            g = static_cast<int>(image[index + 1]);
-            b = static_cast<int>(image[index + 2]);
+    BlockRowAccumulator accumulator(plane.width(), scalar);
+    int end_width = accumulator.blocks();
 
-            avg_lumen += (r + g + b) / 3;
-            //cout << avg_lumen << " ";
-            //cout << "x_pos = " << i << endl << "y_pos = " << j << endl;
+    for (int i = row_begin * scalar; i < row_end * scalar; i++) {
+        if (!accumulator.add_row(plane.row(i))) {
+            continue;
+        }
+        const int * averages = accumulator.averages();
+        for (int j = 0; j < end_width; j++) {
+            memcpy(out, glyphs.pair(averages[j]), 2);
+            out += 2;
         }
+        *out++ = '\n';
     }
-    avg_lumen = avg_lumen / (scalar * scalar);
-    return avg_lumen;
 }
 
-void old_image_to_ascii(const vector<unsigned char> & image, 
-                        const int & width, 
-                        const int & height, 
-                        const string & ascii_lumenance) {
+size_t frame_size(const LumaPlane & plane, const int & scalar) {
+    size_t row_bytes = 2 * static_cast<size_t>(plane.width() / scalar) + 1;
+    return row_bytes * static_cast<size_t>(plane.height() / scalar);
+}
 
-    string output_filename = "output.txt";
-    ofstream out(output_filename);
+// Renders the whole frame into out, which holds frame_size() bytes. With a pool the rows
+// are split into bands, each owning a disjoint slice of the frame, so there is nothing to
+// stitch afterwards.
+void render_frame(const LumaPlane & plane, 
+                  const int & scalar, 
+                  const GlyphTable & glyphs, 
+                  ThreadPool * pool, 
+                  char * out) {
 
-    const size_t RGBA = 4;
-    int r, g, b;
-    int avg_lumen;
-    int ascii_idx;
+    int end_width = plane.width() / scalar;
+    int end_height = plane.height() / scalar;
 
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            size_t index = RGBA * (i * width + j);
-            r = static_cast<int>(image[index + 0]);
-            g = static_cast<int>(image[index + 1]);
-            b = static_cast<int>(image[index + 2]);
+    size_t row_bytes = 2 * static_cast<size_t>(end_width) + 1;
 
-            avg_lumen = ((r + g + b) / 3) * 100;
-            ascii_idx = (avg_lumen / (25500 / (ascii_lumenance.length() - 1)));
-            
-            out << ascii_lumenance[ascii_idx] << ascii_lumenance[ascii_idx];
-        }
-        out << endl;
+    if (pool == nullptr) {
+        render_rows(plane, scalar, glyphs, 0, end_height, out);
+        return;
+    }
+
+    // a few bands per worker so one slow band does not hold up the rest
+    int band_count = min(end_height, static_cast<int>(pool->size()) * 4);
+    vector<future<void>> rendered;
+
+    for (int b = 0; b < band_count; b++) {
+        int row_begin = static_cast<int>(static_cast<long long>(end_height) * b / band_count);
+        int row_end = static_cast<int>(static_cast<long long>(end_height) * (b + 1) / band_count);
+        char * band = out + row_bytes * row_begin;
+        rendered.push_back(pool->submit([&plane, &scalar, &glyphs, row_begin, row_end, band] {
+            render_rows(plane, scalar, glyphs, row_begin, row_end, band);
+        }));
+    }
+    for (future<void> & band : rendered) {
+        band.get();
     }
-    out.close();
 }
 
-void image_to_ascii(const vector<unsigned char> & image, 
-                    const int & width,
-                    const int & height, 
-                    const int & scalar, 
-                    const string & ascii_lumenance) {
+// Same, into a string whose storage is reused.
+void render_frame(const LumaPlane & plane, 
+                  const int & scalar, 
+                  const GlyphTable & glyphs, 
+                  ThreadPool * pool, 
+                  string & frame) {
 
-    string output_filename = "output.txt";
-    ofstream out(output_filename);
+    frame.resize(frame_size(plane, scalar));
+    render_frame(plane, scalar, glyphs, pool, &frame[0]);
+}
 
-    int end_width = width / scalar;
-    int end_height = height / scalar;
+// Same, from a summed-area table: four loads a cell whatever the scale, so an
+// image already in a table is rendered at another scale without walking its
+// pixels again.
+void render_frame(const LumaTable & table, 
+                  const int & scalar, 
+                  const GlyphTable & glyphs, 
+                  string & frame) {
 
-    int ascii_idx;
-    int avg_lumen;
+    int end_width = table.width() / scalar;
+    int end_height = table.height() / scalar;
+    size_t row_bytes = 2 * static_cast<size_t>(end_width) + 1;
+    frame.resize(row_bytes * static_cast<size_t>(end_height));
 
     for (int i = 0; i < end_height; i++) {
+        char * row = &frame[row_bytes * i];
         for (int j = 0; j < end_width; j++) {
-            avg_lumen = avg_lumenance(image, width, scalar, j, i) * 100;
-            //cout << avg_lumen << " ";
-            ascii_idx = (avg_lumen / (25500 / (ascii_lumenance.length() - 1)));
-            
-            out << ascii_lumenance[ascii_idx] << ascii_lumenance[ascii_idx];
-            //cout << j << " ";
+            memcpy(row + 2 * j, glyphs.pair(table.block_average(scalar, j, i)), 2);
+        }
+        row[row_bytes - 1] = '\n';
+    }
+}
+
+// False when the file cannot be opened or written; written says what went out either way.
+bool image_to_ascii(const LumaPlane & plane, 
+                    const int & scalar, 
+                    const GlyphTable & glyphs, 
+                    const string & output_filename, 
+                    ThreadPool * pool, 
+                    WriteStats & written) {
+
+    AsciiWriter out(output_filename);
+    if (!out.is_open()) {
+        written = WriteStats();
+        return false;
+    }
+
+    string frame;
+    render_frame(plane, scalar, glyphs, pool, frame);
+    out.add(frame);
+    bool ok = out.flush();
+    written = out.stats();
+    return ok;
+}
+
+// Sink for stream_image_luma: reduces scanlines as they arrive and writes the
+// finished text rows out in large chunks.
+class AsciiStream {
+public:
+    AsciiStream(const int & scalar, const GlyphTable & glyphs, AsciiWriter & out)
+        : scalar_(scalar), glyphs_(glyphs), out_(out), width_(0), height_(0), written_(true) {}
+
+    // reduce is how much smaller than the image the decoder made the rows
+    void start(int width, int height, int reduce) {
+        width_ = width;
+        height_ = height;
+        accumulator_.reset(new BlockRowAccumulator(width, scalar_ / reduce));
+        pending_.reserve(flush_bytes + 2 * accumulator_->blocks() + 1);
+    }
+
+    void row(const unsigned char * luma) {
+        if (!accumulator_->add_row(luma)) {
+            return;
         }
-        //cout << endl;
-        out << endl;
+        const int * averages = accumulator_->averages();
+        size_t at = pending_.size();
+        pending_.resize(at + 2 * accumulator_->blocks() + 1);
+        char * out = &pending_[at];
+        for (int j = 0; j < accumulator_->blocks(); j++) {
+            memcpy(out, glyphs_.pair(averages[j]), 2);
+            out += 2;
+        }
+        *out = '\n';
+        if (pending_.size() >= flush_bytes) {
+            finish();
+        }
+    }
+
+    void finish() {
+        out_.add(pending_);
+        written_ = out_.flush() && written_;
+        pending_.clear();
+    }
+
+    int width() const { return width_; }
+    int height() const { return height_; }
+    // false once any write has failed
+    bool written() const { return written_; }
+
+private:
+    static const size_t flush_bytes = 1 << 20;
+
+    const int scalar_;
+    const GlyphTable & glyphs_;
+    AsciiWriter & out_;
+    unique_ptr<BlockRowAccumulator> accumulator_;
+    string pending_;
+    int width_;
+    int height_;
+    bool written_;
+};
+
+// Decode and reduction run interleaved on scanlines, so memory stays O(width)
+// for baseline JPEGs and non-interlaced PNGs. Luminance is the decoder's own (Y for JPEG), as with --luma.
+// reduce lets the decoder shrink JPEGs by that much first; it must divide scalar.
+// False when the image cannot be read or the text cannot be written.
+bool stream_image_to_ascii(const string & input, 
+                           const int & scalar, 
+                           const int & reduce, 
+                           const GlyphTable & glyphs, 
+                           const string & output_filename, 
+                           int & width, 
+                           int & height, 
+                           WriteStats & written, 
+                           ImageFormat format = ImageFormat::Unknown) {
+
+    MappedFile file;
+    if (!file.open(input) || file.size() > INT_MAX) {
+        return false;
+    }
+    AsciiWriter out(output_filename);
+    if (!out.is_open()) {
+        return false;
+    }
+
+    AsciiStream stream(scalar, glyphs, out);
+    bool ok = stream_image_luma(file.data(), static_cast<int>(file.size()), reduce, stream, format);
+    stream.finish();
+    width = stream.width();
+    height = stream.height();
+    written = out.stats();
+    return ok && stream.written();
+}
+
+constexpr char default_ascii_lumenance[] = " `.-':_,^=;><+!rc*/z?sLTv)J7(|Fi{C}fI31tlu[neoZ5Yxjya]2ESwqkP6h9d4VpOGbUAKXHm8RD#$Bg0MNWQ%&@";
+constexpr GlyphTable default_glyphs(default_ascii_lumenance, sizeof(default_ascii_lumenance) - 1);
+
+struct BatchOptions {
+    vector<string> inputs;
+    string output_dir = ".";
+    string output_template = "{name}.txt";
+    string ascii_lumenance = default_ascii_lumenance;
+    int scalar = 1;
+    vector<int> scalars;   // every scale of a -s list, scalar being the first
+    unsigned threads = 0;
+    bool luma_decode = false;
+    bool stream = false;
+    bool scaled_idct = false;
+    ImageFormat format = ImageFormat::Unknown;
+    LumaModel luma_model = LumaModel::Mean;
+    bool daemon = false;
+    string socket_path = render_default_socket;
+    bool play = false;
+    double fps = 30;
+    bool fps_given = false;
+    int raw_width = 0;     // with --raw, stdin holds frames of this shape
+    int raw_height = 0;
+    int raw_channels = 0;
+};
+
+void print_usage(const char * program) {
+    cout << "Usage: " << program << " [options] image..." << endl
+         << "       " << program << "            (interactive, writes output.txt)" << endl
+         << endl
+         << "  -s, --scale N         downscaling factor (default 1); a list like 4,8,16" << endl
+         << "                        renders each file at every scale from one decode" << endl
+         << "  -p, --palette CHARS   glyphs from darkest to brightest" << endl
+         << "  -o, --output-dir DIR  where rendered files go (default .)" << endl
+         << "  -t, --template T      output file name, {name} {index} {scale} are" << endl
+         << "                        replaced (default {name}.txt)" << endl
+         << "  -m, --manifest FILE   read input paths from FILE, one per line" << endl
+         << "  -j, --threads N       files rendered at once; with fewer files the rest" << endl
+         << "                        split each file's work (default: all cores)" << endl
+         << "  -f, --format F        trust every input to be F (jpeg, png, bmp, gif, psd," << endl
+         << "                        pic, pnm, hdr, tga) instead of checking (default auto)" << endl
+         << "  -l, --luma-model M    how pixels become brightness: mean (default), rec601," << endl
+         << "                        rec709 or linear (gamma-correct Rec.709)" << endl
+         << "      --luma            decode JPEGs to their Y plane only" << endl
+         << "      --stream          reduce scanlines while decoding (implies --luma)" << endl
+         << "      --scaled-idct     decode JPEGs at 1/2, 1/4 or 1/8 size when the" << endl
+         << "                        scale allows it (implies --luma)" << endl
+         << "      --play            show the inputs in order as frames on the terminal," << endl
+         << "                        redrawing only the cells that change" << endl
+         << "      --fps N           frame rate for --play, dropping frames to keep up;" << endl
+         << "                        0 plays as fast as it can (default 30)" << endl
+         << "      --raw WxHxC       the input - (stdin) is raw frames of W x H pixels with" << endl
+         << "                        C = 1 (gray), 3 (RGB) or 4 (RGBA) channels; without it" << endl
+         << "                        stdin must be YUV4MPEG2" << endl
+         << "      --daemon          serve render requests on a Unix socket (ascii-artd)" << endl
+         << "  -S, --socket PATH     socket for --daemon (default " << render_default_socket << ")" << endl
+         << "  -h, --help            show this message" << endl;
+}
+
+bool read_manifest(const string & manifest, vector<string> & inputs) {
+    ifstream in(manifest);
+    if (!in) {
+        return false;
+    }
+    string line;
+    while (getline(in, line)) {
+        size_t begin = line.find_first_not_of(" \t\r");
+        if (begin == string::npos || line[begin] == '#') {
+            continue;
+        }
+        size_t end = line.find_last_not_of(" \t\r");
+        inputs.push_back(line.substr(begin, end - begin + 1));
     }
-    out.close();
+    return true;
 }
 
+// Returns 0 when the options are usable, otherwise the exit code to quit with.
+int parse_options(int argc, char * argv[], BatchOptions & options) {
+    const vector<string> value_options = {"-s", "--scale", "-p", "--palette", "-o", "--output-dir",
+                                          "-t", "--template", "-j", "--threads", "-m", "--manifest",
+                                          "-f", "--format", "-l", "--luma-model", "-S", "--socket",
+                                          "--fps", "--raw"};
+
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+
+        if (arg == "-h" || arg == "--help") {
+            print_usage(argv[0]);
+            return -1;
+        } else if (arg == "--luma") {
+            options.luma_decode = true;
+        } else if (arg == "--stream") {
+            options.stream = true;
+        } else if (arg == "--daemon") {
+            options.daemon = true;
+        } else if (arg == "--play") {
+            options.play = true;
+        } else if (arg == "--scaled-idct") {
+            options.scaled_idct = true;
+            options.luma_decode = true;
+        } else if (arg.size() > 1 && arg[0] == '-') {
+            if (find(value_options.begin(), value_options.end(), arg) == value_options.end()) {
+                cerr << "Unknown option " << arg << endl;
+                return 2;
+            }
+            if (i + 1 >= argc) {
+                cerr << "Missing value for " << arg << endl;
+                return 2;
+            }
+            string value = argv[++i];
+
+            if (arg == "-s" || arg == "--scale") {
+                options.scalars.clear();
+                for (size_t at = 0; at <= value.size();) {
+                    size_t comma = min(value.find(',', at), value.size());
+                    options.scalars.push_back(atoi(value.substr(at, comma - at).c_str()));
+                    at = comma + 1;
+                }
+                options.scalar = options.scalars.front();
+            } else if (arg == "-p" || arg == "--palette") {
+                options.ascii_lumenance = value;
+            } else if (arg == "-o" || arg == "--output-dir") {
+                options.output_dir = value;
+            } else if (arg == "-t" || arg == "--template") {
+                options.output_template = value;
+            } else if (arg == "-j" || arg == "--threads") {
+                options.threads = static_cast<unsigned>(max(0, atoi(value.c_str())));
+            } else if (arg == "-f" || arg == "--format") {
+                if (!parse_image_format(value, options.format)) {
+                    cerr << "Unknown image format " << value << endl;
+                    return 2;
+                }
+            } else if (arg == "-S" || arg == "--socket") {
+                options.socket_path = value;
+            } else if (arg == "--fps") {
+                options.fps = max(0.0, atof(value.c_str()));
+                options.fps_given = true;
+            } else if (arg == "--raw") {
+                char tail = '\0';
+                if (sscanf(value.c_str(), "%dx%dx%d%c", &options.raw_width, &options.raw_height, &options.raw_channels, &tail) != 3 || 
+                    options.raw_width <= 0 || options.raw_height <= 0) {
+                    cerr << "--raw wants WIDTHxHEIGHTxCHANNELS" << endl;
+                    return 2;
+                }
+            } else if (arg == "-l" || arg == "--luma-model") {
+                if (!parse_luma_model(value, options.luma_model)) {
+                    cerr << "Unknown luminance model " << value << endl;
+                    return 2;
+                }
+            } else if (!read_manifest(value, options.inputs)) {
+                cerr << "Error reading manifest " << value << endl;
+                return 2;
+            }
+        } else {
+            options.inputs.push_back(arg);
+        }
+    }
+
+    if (options.scalars.empty()) {
+        options.scalars.push_back(options.scalar);
+    }
+    if (*min_element(options.scalars.begin(), options.scalars.end()) < 1) {
+        cerr << "Scale must be at least 1" << endl;
+        return 2;
+    }
+    if (*max_element(options.scalars.begin(), options.scalars.end()) > max_block_scale) {
+        cerr << "Scale must be at most " << max_block_scale << endl;
+        return 2;
+    }
+    if (options.scalars.size() > 1) {
+        if (options.stream || options.play || options.daemon || find(options.inputs.begin(), options.inputs.end(), "-") != options.inputs.end()) {
+            cerr << "Several scales only work for batch rendering without --stream" << endl;
+            return 2;
+        }
+        // each scale needs a file of its own
+        if (options.output_template.find("{scale}") == string::npos) {
+            if (options.output_template != "{name}.txt") {
+                cerr << "With several scales the template needs {scale}" << endl;
+                return 2;
+            }
+            options.output_template = "{name}-{scale}.txt";
+        }
+    }
+    if (options.ascii_lumenance.length() < 2 || options.ascii_lumenance.length() > 256) {
+        cerr << "Palette needs between 2 and 256 characters" << endl;
+        return 2;
+    }
+    if (options.inputs.empty() && !options.daemon) {
+        cerr << "No input images" << endl;
+        return 2;
+    }
+    if (options.inputs.size() > 1 && find(options.inputs.begin(), options.inputs.end(), "-") != options.inputs.end()) {
+        cerr << "- (frames on stdin) has to be the only input" << endl;
+        return 2;
+    }
+    return 0;
+}
+
+string output_path(const BatchOptions & options, const string & input, size_t index, int scalar) {
+    size_t slash = input.find_last_of('/');
+    string name = input.substr(slash == string::npos ? 0 : slash + 1);
+    size_t dot = name.find_last_of('.');
+    if (dot != string::npos && dot > 0) {
+        name = name.substr(0, dot);
+    }
+
+    string path = options.output_template;
+    const pair<string, string> fields[] = {
+        {"{name}", name},
+        {"{index}", to_string(index)},
+        {"{scale}", to_string(scalar)},
+    };
+    for (const auto & field : fields) {
+        for (size_t at = path.find(field.first); at != string::npos; at = path.find(field.first, at + field.second.size())) {
+            path.replace(at, field.first.size(), field.second);
+        }
+    }
+    return options.output_dir + "/" + path;
+}
+
+struct BatchResult {
+    bool ok = false;
+    int width = 0;
+    int height = 0;
+    size_t bytes = 0;
+    double load_ms = 0;
+    double render_ms = 0;
+};
+
+double elapsed_ms(chrono::steady_clock::time_point since) {
+    return chrono::duration<double, milli>(chrono::steady_clock::now() - since).count();
+}
+
+// Writes input to outputs, one per entry of options.scalars. spare_pool, when
+// given, splits a JPEG's restart intervals across threads and renders the
+// frame in bands on them.
+BatchResult render_file(const BatchOptions & options, const GlyphTable & glyphs, const string & input, const vector<string> & outputs, ThreadPool * spare_pool) {
+    BatchResult result;
+    auto start = chrono::steady_clock::now();
+    // the decoder may only shrink by what every scale divides by
+    int common = 0;
+    for (int scalar : options.scalars) {
+        common = gcd(common, scalar);
+    }
+    int reduce = options.scaled_idct ? jpeg_reduction_for_scale(common) : 1;
+    const string & output = outputs.front();
+
+    if (options.stream) {
+        WriteStats written;
+        result.ok = stream_image_to_ascii(input, options.scalar, reduce, glyphs, output, result.width, result.height, written, options.format);
+        result.render_ms = elapsed_ms(start);
+        result.bytes = written.bytes;
+        return result;
+    }
+
+    MappedFile file;
+    ImageBuffer image;
+    ImageView view;
+    bool loaded = options.luma_decode ? load_image_luma(image, input, reduce, spare_pool, options.format)
+                                      : load_image(file, image, view, input, options.format);
+    if (!loaded) {
+        return result;
+    }
+    if (options.luma_decode) {
+        view = image.view();
+    }
+    result.width = view.width;
+    result.height = view.height;
+    result.load_ms = elapsed_ms(start);
+
+    // files are the unit of parallelism; only threads they leave idle split a frame
+    start = chrono::steady_clock::now();
+    LumaPlane plane(view, options.luma_model);
+    image.reset();
+    file.close();
+    if (plane.empty()) {
+        return result;
+    }
+    // an image smaller than one block makes an empty frame, which is still a success
+    if (options.scalars.size() == 1) {
+        WriteStats written;
+        result.ok = image_to_ascii(plane, options.scalar / reduce, glyphs, output, spare_pool, written);
+        result.render_ms = elapsed_ms(start);
+        result.bytes = written.bytes;
+        return result;
+    }
+
+    // one pass builds the table, and every scale after that is lookups
+    LumaTable table(plane);
+    string frame;
+    result.ok = true;
+    for (size_t k = 0; k < options.scalars.size() && result.ok; k++) {
+        render_frame(table, options.scalars[k] / reduce, glyphs, frame);
+        AsciiWriter out(outputs[k]);
+        out.add(frame);
+        result.ok = out.is_open() && out.flush();
+        result.bytes += out.stats().bytes;
+    }
+    result.render_ms = elapsed_ms(start);
+    return result;
+}
+
+bool reads_stdin(const BatchOptions & options) {
+    return options.inputs.size() == 1 && options.inputs[0] == "-";
+}
+
+// Reads the stream header: --raw says the frame shape, otherwise it has to be Y4M.
+bool open_frame_stream(const BatchOptions & options, FrameStream & stream) {
+    bool opened = options.raw_width > 0 ? stream.open_raw(options.raw_width, options.raw_height, options.raw_channels)
+                                        : stream.open_y4m();
+    if (!opened && !stream.error().empty()) {
+        cerr << "stdin: " << stream.error() << endl;
+    }
+    return opened;
+}
+
+// Points plane at a frame off the stream: Y4M luma and gray frames are used
+// where they lie, colour frames go through the luminance model.
+bool stream_plane(const BatchOptions & options, const ImageView & view, LumaPlane & plane) {
+    return plane.borrow(view) || plane.build(view, options.luma_model);
+}
+
+// Renders every frame on stdin, back to back, into the one output file. Lines go
+// to stderr so the text can go to /dev/stdout.
+int run_stream_batch(const BatchOptions & options) {
+    FrameStream stream(STDIN_FILENO);
+    if (!open_frame_stream(options, stream)) {
+        return 1;
+    }
+    string output = output_path(options, "stdin", 0, options.scalar);
+    AsciiWriter out(output);
+    if (!out.is_open()) {
+        cerr << "Cannot write " << output << endl;
+        return 1;
+    }
+
+    ThreadPool pool(options.threads);
+    const GlyphTable glyphs(options.ascii_lumenance);
+    LumaPlane plane;
+    string frame;
+    ImageView view;
+    size_t frames = 0;
+    auto start = chrono::steady_clock::now();
+    while (stream.next(view)) {
+        if (!stream_plane(options, view, plane)) {
+            cerr << "Out of memory" << endl;
+            return 1;
+        }
+        render_frame(plane, options.scalar, glyphs, &pool, frame);
+        out.add(frame);
+        if (!out.flush()) {
+            cerr << "Error writing " << output << endl;
+            return 1;
+        }
+        frames++;
+    }
+    if (!stream.error().empty()) {
+        cerr << "stdin: " << stream.error() << endl;
+    }
+
+    double seconds = elapsed_ms(start) / 1000.0;
+    cerr << "stdin -> " << output << ": " << frames << " frames of " << stream.width() << " x " << stream.height()
+         << " in " << seconds << " s, " << frames / seconds << " frames/s" << endl;
+    return stream.error().empty() ? 0 : 1;
+}
+
+int run_batch(const BatchOptions & options) {
+    if (mkdir(options.output_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+        cerr << "Cannot create output directory " << options.output_dir << endl;
+        return 1;
+    }
+    if (reads_stdin(options)) {
+        return run_stream_batch(options);
+    }
+
+    ThreadPool pool(options.threads);
+    // with fewer files than threads the spare ones go to decoding and rendering
+    // each file; it is a separate pool since file workers block on it. --stream
+    // reduces rows as they are decoded, so it has nothing to split.
+    unique_ptr<ThreadPool> spare_pool;
+    if (!options.stream && options.inputs.size() < pool.size()) {
+        spare_pool.reset(new ThreadPool(pool.size()));
+    }
+    const GlyphTable glyphs(options.ascii_lumenance);
+    mutex report;
+    size_t failed = 0;
+    double megapixels = 0;
+    auto start = chrono::steady_clock::now();
+
+    vector<future<void>> jobs;
+    for (size_t i = 0; i < options.inputs.size(); i++) {
+        jobs.push_back(pool.submit([&, i] {
+            const string & input = options.inputs[i];
+            vector<string> outputs;
+            for (int scalar : options.scalars) {
+                outputs.push_back(output_path(options, input, i, scalar));
+            }
+            BatchResult result = render_file(options, glyphs, input, outputs, spare_pool.get());
+
+            lock_guard<mutex> lock(report);
+            if (!result.ok) {
+                failed++;
+                cerr << input << ": error loading or writing image" << endl;
+                return;
+            }
+            double mp = static_cast<double>(result.width) * result.height / 1e6;
+            megapixels += mp;
+            cout << input << " -> " << outputs.front() << (outputs.size() > 1 ? " (and " + to_string(outputs.size() - 1) + " more)" : "")
+                 << ": " << result.width << " x " << result.height
+                 << ", load " << result.load_ms << " ms, render " << result.render_ms << " ms, "
+                 << mp / ((result.load_ms + result.render_ms) / 1000.0) << " MP/s" << endl;
+        }));
+    }
+    for (future<void> & job : jobs) {
+        job.get();
+    }
+
+    double seconds = elapsed_ms(start) / 1000.0;
+    size_t done = options.inputs.size() - failed;
+    cout << done << " of " << options.inputs.size() << " files in " << seconds << " s on "
+         << pool.size() << " threads: " << done / seconds << " files/s, "
+         << megapixels / seconds << " MP/s" << endl;
+    return failed == 0 ? 0 : 1;
+}
+
+// Loads one input into plane the way the batch options say; reduce is how much
+// smaller than the image the decoder already made it.
+bool load_plane(const BatchOptions & options, const string & input, LumaPlane & plane, int & reduce) {
+    reduce = options.scaled_idct ? jpeg_reduction_for_scale(options.scalar) : 1;
+    MappedFile file;
+    ImageBuffer image;
+    ImageView view;
+    bool loaded = options.luma_decode ? load_image_luma(image, input, reduce, nullptr, options.format)
+                                      : load_image(file, image, view, input, options.format);
+    if (!loaded) {
+        return false;
+    }
+    if (options.luma_decode) {
+        view = image.view();
+    }
+    return plane.build(view, options.luma_model);
+}
+
+volatile sig_atomic_t playback_stopping = 0;
+
+void stop_playback(int) {
+    playback_stopping = 1;
+}
+
+// set on SIGWINCH; the next frame is then drawn whole
+volatile sig_atomic_t playback_resized = 0;
+
+void note_resize(int) {
+    playback_resized = 1;
+}
+
+// One frame on its way through the player. A fixed set of these circulates
+// between the stages, so steady playback does not allocate. Stream frames are
+// read into the frame's own buffer, which plane may borrow, so it stays put
+// until the frame goes back to spare.
+struct PlayFrame {
+    size_t index = 0;
+    chrono::steady_clock::time_point started;
+    int reduce = 1;
+    unique_ptr<unsigned char[]> pixels;
+    LumaPlane plane;
+    string text;
+};
+
+typedef unique_ptr<PlayFrame> PlayFramePtr;
+
+void report_stage(const char * name, StageTimes & times) {
+    cerr << "  " << name << ": p50 " << times.percentile(0.5) << " ms, p99 " << times.percentile(0.99)
+         << " ms over " << times.count() << " frames" << endl;
+}
+
+// Shows the inputs one after another as frames of a video, each as a single
+// write holding only the cells that differ from the frame before. Decode
+// (load and luma), reduce (glyphs) and present (diff and write, paced to
+// --fps) overlap on their own threads. A stage that finds a frame stale
+// drops it: decode skips it outright, reduce and present only when a newer
+// frame is already waiting, so falling behind costs frames, not latency.
+// With - the frames come off stdin, at the Y4M frame rate unless --fps says.
+int run_play(const BatchOptions & options) {
+    struct sigaction stop = {};
+    stop.sa_handler = stop_playback;
+    sigaction(SIGINT, &stop, nullptr);
+    sigaction(SIGTERM, &stop, nullptr);
+    struct sigaction resize = {};
+    resize.sa_handler = note_resize;
+    resize.sa_flags = SA_RESTART;
+    sigaction(SIGWINCH, &resize, nullptr);
+
+    typedef chrono::steady_clock clock_type;
+    const size_t depth = 2;
+    // every frame is either spare, queued, or held by one stage
+    const size_t in_flight = 2 * depth + 3;
+
+    // frames are read into their PlayFrame, so the stream keeps no ring
+    unique_ptr<FrameStream> stream;
+    double fps = options.fps;
+    if (reads_stdin(options)) {
+        stream.reset(new FrameStream(STDIN_FILENO, 0));
+        stream->stop_when(&playback_stopping);
+        if (!open_frame_stream(options, *stream)) {
+            return stream->error().empty() ? 0 : 1;
+        }
+        if (!options.fps_given && stream->fps() > 0) {
+            fps = stream->fps();
+        }
+    }
+    // a stream's length is not known up front
+    const size_t frame_count = stream ? SIZE_MAX : options.inputs.size();
+    ThreadPool pool(options.threads);
+    const GlyphTable glyphs(options.ascii_lumenance);
+    FrameClock clock(fps);
+
+    BoundedQueue<PlayFramePtr> spare(in_flight);
+    BoundedQueue<PlayFramePtr> decoded(depth);
+    BoundedQueue<PlayFramePtr> reduced(depth);
+    for (size_t i = 0; i < in_flight; i++) {
+        PlayFramePtr frame(new PlayFrame);
+        if (stream) {
+            frame->pixels.reset(new (nothrow) unsigned char[stream->frame_bytes()]);
+            if (frame->pixels == nullptr) {
+                cerr << "Out of memory" << endl;
+                return 1;
+            }
+        }
+        spare.push(move(frame));
+    }
+    StageTimes decode_ms;
+    StageTimes reduce_ms;
+    StageTimes present_ms;
+    StageTimes latency_ms;
+    size_t dropped_decode = 0;
+    size_t dropped_reduce = 0;
+    size_t dropped_present = 0;
+    size_t failed = 0;
+    size_t offered = 0;
+
+    thread decoder([&] {
+        // a dropped frame's PlayFrame is kept for the next one
+        PlayFramePtr frame;
+        for (size_t i = 0; i < frame_count && !playback_stopping; i++) {
+            if (!frame && !spare.pop(frame)) {
+                break;
+            }
+            // stream frames are read even when dropped, to keep up with the pipe
+            ImageView view;
+            if (stream && !stream->next(view, frame->pixels.get())) {
+                break;
+            }
+            offered++;
+            // the last frame always shows, so the picture ends where the input does
+            if (i + 1 < frame_count && clock.stale(i, clock_type::now())) {
+                dropped_decode++;
+                continue;
+            }
+            // nor does it start more than a couple of frames early, which
+            // would only make every frame wait longer to be seen
+            if (clock.paced() && clock.started()) {
+                this_thread::sleep_until(clock.due(i) - 2 * clock.period());
+            }
+            frame->index = i;
+            frame->started = clock_type::now();
+            frame->reduce = 1;
+            bool loaded = stream ? stream_plane(options, view, frame->plane)
+                                 : load_plane(options, options.inputs[i], frame->plane, frame->reduce);
+            if (!loaded) {
+                // reported at the end, so the picture is not scribbled over
+                failed++;
+                continue;
+            }
+            decode_ms.add(frame->started);
+            if (!decoded.push(move(frame))) {
+                break;
+            }
+        }
+        if (frame) {
+            spare.push(move(frame));
+        }
+        decoded.close();
+    });
+
+    thread reducer([&] {
+        PlayFramePtr frame;
+        while (decoded.pop(frame)) {
+            if (clock.stale(frame->index, clock_type::now()) && decoded.ready()) {
+                dropped_reduce++;
+                spare.push(move(frame));
+                continue;
+            }
+            auto start = clock_type::now();
+            render_frame(frame->plane, options.scalar / frame->reduce, glyphs, &pool, frame->text);
+            reduce_ms.add(start);
+            if (!reduced.push(move(frame))) {
+                break;
+            }
+        }
+        reduced.close();
+    });
+
+    TerminalDiff terminal;
+    AsciiWriter out(STDOUT_FILENO);
+    // hide the cursor while playing; AsciiWriter keeps only a view, so no temporary
+    static const char hide_cursor[] = "\x1b[?25l";
+    out.add(hide_cursor, sizeof(hide_cursor) - 1);
+    bool ok = out.flush();
+    int write_error = ok ? 0 : errno;
+    clock_type::time_point first_shown;
+    clock_type::time_point last_shown;
+
+    PlayFramePtr frame;
+    while (ok && !playback_stopping && reduced.pop(frame)) {
+        auto now = clock_type::now();
+        if (!clock.paced()) {
+            // shown as soon as it is ready
+        } else if (!clock.started()) {
+            clock.start(frame->index, now);
+        } else if (now < clock.due(frame->index)) {
+            this_thread::sleep_until(clock.due(frame->index));
+        } else if (clock.stale(frame->index, now) && reduced.ready()) {
+            dropped_present++;
+            spare.push(move(frame));
+            continue;
+        }
+
+        auto start = clock_type::now();
+        // a resized terminal may have rewrapped or cleared what is on screen
+        if (playback_resized) {
+            playback_resized = 0;
+            terminal.reset();
+        }
+        out.add(terminal.update(frame->text.data(), frame->text.size()));
+        ok = out.flush();
+        if (!ok) {
+            write_error = errno;
+            break;
+        }
+        last_shown = clock_type::now();
+        if (terminal.frames() == 1) {
+            first_shown = last_shown;
+        }
+        present_ms.add(start);
+        latency_ms.add(frame->started);
+        spare.push(move(frame));
+    }
+    // a decoder blocked reading stdin only watches playback_stopping
+    if (!ok) {
+        playback_stopping = 1;
+    }
+    // unblock whichever stages are still waiting, then wait for them
+    spare.close();
+    decoded.close();
+    reduced.close();
+    decoder.join();
+    reducer.join();
+
+    string restore = terminal.park() + "\x1b[?25h";
+    out.add(restore);
+    out.flush();
+
+    size_t shown = terminal.frames();
+    double seconds = chrono::duration<double>(last_shown - first_shown).count();
+    cerr << shown << " of " << offered << " frames shown, "
+         << dropped_decode + dropped_reduce + dropped_present << " dropped (decode " << dropped_decode
+         << ", reduce " << dropped_reduce << ", present " << dropped_present << "), "
+         << (shown > 1 && seconds > 0 ? (shown - 1) / seconds : 0.0) << " fps";
+    if (clock.paced()) {
+        cerr << " of " << fps << " targeted";
+    }
+    cerr << endl;
+    report_stage("decode ", decode_ms);
+    report_stage("reduce ", reduce_ms);
+    report_stage("present", present_ms);
+    report_stage("latency", latency_ms);
+    cerr << terminal.bytes() << " bytes written, "
+         << (terminal.full_bytes() > 0 ? 100.0 * terminal.bytes() / terminal.full_bytes() : 0.0)
+         << "% of full redraws" << endl;
+    if (failed > 0) {
+        cerr << failed << " inputs could not be loaded" << endl;
+    }
+    if (stream && !stream->error().empty()) {
+        cerr << "stdin: " << stream->error() << endl;
+        failed++;
+    }
+    if (!ok) {
+        cerr << "Error writing stdout: " << strerror(write_error) << endl;
+    }
+    return failed == 0 && ok ? 0 : 1;
+}
+
+volatile sig_atomic_t daemon_stopping = 0;
+
+void stop_daemon(int) {
+    daemon_stopping = 1;
+}
+
+// Kept per worker between requests, so steady traffic stops allocating.
+struct DaemonScratch {
+    LumaPlane plane;
+    string frame;
+    // AsciiWriter keeps only a view of it, so it has to outlive the flush
+    string header;
+};
+
+// Renders one request into scratch.frame, or straight into its reply slot in
+// shared; on failure error says why. Options the request leaves out fall back
+// to the daemon's own command line.
+bool render_request(const BatchOptions & options, 
+                    const RenderRequest & request, 
+                    const SharedMapping & shared, 
+                    DaemonScratch & scratch, 
+                    string & error) {
+    ImageFormat format = options.format;
+    LumaModel model = options.luma_model;
+    const string & palette = request.palette.empty() ? options.ascii_lumenance : request.palette;
+    if (!request.format.empty() && !parse_image_format(request.format, format)) {
+        error = "Unknown image format " + request.format;
+        return false;
+    }
+    if (!request.model.empty() && !parse_luma_model(request.model, model)) {
+        error = "Unknown luminance model " + request.model;
+        return false;
+    }
+    // text is the only output so far; naming it keeps room for others without
+    // a protocol change, and anything else is refused rather than ignored
+    if (!request.output.empty() && request.output != "text") {
+        error = "Unknown output format " + request.output;
+        return false;
+    }
+    if (request.scalar < 1) {
+        error = "Scale must be at least 1";
+        return false;
+    }
+    if (request.scalar > max_block_scale) {
+        error = "Scale must be at most " + to_string(max_block_scale);
+        return false;
+    }
+    if (palette.length() < 2 || palette.length() > 256) {
+        error = "Palette needs between 2 and 256 characters";
+        return false;
+    }
+    if ((request.shared_frame || request.shared_reply) && !shared.is_mapped()) {
+        error = "No shared memory on this connection";
+        return false;
+    }
+
+    MappedFile file;
+    ImageBuffer image;
+    ImageView view;
+    if (request.shared_frame) {
+        // the client's pixels, read where they lie
+        const SharedFrame & frame = request.frame;
+        size_t row_bytes = static_cast<size_t>(frame.width) * frame.channels;
+        bool fits = frame.width > 0 && frame.height > 0 && frame.stride >= row_bytes && 
+                    frame.stride <= shared.size() / frame.height && 
+                    shared.contains(frame.offset, frame.stride * (frame.height - 1) + row_bytes);
+        if (frame.channels != 1 && frame.channels != 3 && frame.channels != 4) {
+            error = "Shared frames need 1, 3 or 4 channels";
+            return false;
+        }
+        if (!fits) {
+            error = "Shared frame lies outside the shared memory";
+            return false;
+        }
+        view.pixels = shared.at(frame.offset);
+        view.width = frame.width;
+        view.height = frame.height;
+        view.channels = frame.channels;
+        view.stride = static_cast<ptrdiff_t>(frame.stride);
+    } else {
+        bool loaded = request.path.empty()
+                          ? load_image(reinterpret_cast<const unsigned char *>(request.data.data()), request.data.size(), image, view, format)
+                          : load_image(file, image, view, request.path, format);
+        if (!loaded) {
+            error = "Error loading image";
+            return false;
+        }
+    }
+    // shared luma frames are read where they lie
+    bool built = (request.shared_frame && scratch.plane.borrow(view)) || scratch.plane.build(view, model);
+    if (!built) {
+        error = "Out of memory";
+        return false;
+    }
+    image.reset();
+    file.close();
+
+    GlyphTable glyphs(palette);
+    if (request.shared_reply) {
+        if (!shared.contains(request.reply.offset, request.reply.capacity) || 
+            frame_size(scratch.plane, request.scalar) > request.reply.capacity) {
+            error = "Reply slot too small";
+            return false;
+        }
+        render_frame(scratch.plane, request.scalar, glyphs, nullptr, reinterpret_cast<char *>(shared.at(request.reply.offset)));
+        return true;
+    }
+    render_frame(scratch.plane, request.scalar, glyphs, nullptr, scratch.frame);
+    return true;
+}
+
+// Answers requests on one connection until the client hangs up, goes quiet
+// for a minute either way, or sends something malformed.
+void serve_connection(const BatchOptions & options, int fd) {
+    thread_local DaemonScratch scratch;
+    // a client that stops reading its answers is dropped like one that stops sending
+    timeval idle = {60, 0};
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &idle, sizeof(idle));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &idle, sizeof(idle));
+
+    SocketReader in(fd);
+    SharedMapping shared;
+    RenderRequest request;
+    string error;
+    while (read_render_request(in, request)) {
+        bool ok = true;
+        if (request.scalar == 0) {
+            request.scalar = options.scalar;
+        }
+        if (request.memfd >= 0) {
+            // the mapping keeps the memory; the descriptor is not needed past here
+            ok = shared.map(request.memfd);
+            close(request.memfd);
+            error = "Cannot map shared memory; it must be a memfd sealed against shrinking";
+        }
+        ok = ok && render_request(options, request, shared, scratch, error);
+
+        AsciiWriter out(fd);
+        if (ok && request.shared_reply) {
+            scratch.header = render_shared_response(frame_size(scratch.plane, request.scalar));
+            out.add(scratch.header);
+        } else {
+            const string & body = ok ? scratch.frame : error;
+            scratch.header = render_response_header(ok, body.size());
+            out.add(scratch.header);
+            out.add(body);
+        }
+        if (!out.flush()) {
+            break;
+        }
+    }
+    close(fd);
+}
+
+// Turns away a connection with an error in place of the first answer. The
+// message is small enough for the socket buffer, so this never waits.
+void refuse_connection(int fd, const string & reason) {
+    string refusal = render_response_header(false, reason.size()) + reason;
+    send(fd, refusal.data(), refusal.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+    close(fd);
+}
+
+// ascii-artd: each connection runs on a worker of one long-lived pool, so
+// requests skip process startup and reuse warm buffers. A connection holds
+// its worker until it closes, so there are never more connections than
+// workers; the rest are refused rather than left waiting behind them.
+// Stops on SIGINT or SIGTERM.
+int run_daemon(const BatchOptions & options) {
+    int listener = listen_render_socket(options.socket_path);
+    if (listener < 0) {
+        cerr << "Cannot listen on " << options.socket_path << ": " << strerror(errno) << endl;
+        return 1;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    // no SA_RESTART, so a signal breaks accept() out of its wait
+    struct sigaction stop = {};
+    stop.sa_handler = stop_daemon;
+    sigaction(SIGINT, &stop, nullptr);
+    sigaction(SIGTERM, &stop, nullptr);
+
+    ThreadPool pool(options.threads);
+    cout << "Listening on " << options.socket_path << " with " << pool.size() << " workers" << endl;
+
+    atomic<unsigned> connections(0);
+    int status = 0;
+    while (!daemon_stopping) {
+        int fd = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // out of descriptors or memory for now: connections that close
+            // free them again, so wait a little rather than stop serving
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS || errno == ENOMEM || errno == EPROTO) {
+                cerr << "accept: " << strerror(errno) << endl;
+                this_thread::sleep_for(chrono::milliseconds(100));
+                continue;
+            }
+            cerr << "accept: " << strerror(errno) << endl;
+            status = 1;
+            break;
+        }
+        if (connections.load() >= pool.size()) {
+            refuse_connection(fd, "Too many connections; the daemon has " + to_string(pool.size()) + " workers");
+            continue;
+        }
+        connections++;
+        pool.submit([&options, &connections, fd] {
+            serve_connection(options, fd);
+            connections--;
+        });
+    }
+    close(listener);
+    unlink(options.socket_path.c_str());
+    return status;
+}
+
+int main(int argc, char * argv[]) {
+    if (argc > 1) {
+        BatchOptions options;
+        int status = parse_options(argc, argv, options);
+        if (status != 0) {
+            return max(status, 0);
+        }
+        if (options.daemon) {
+            return run_daemon(options);
+        }
+        return options.play ? run_play(options) : run_batch(options);
+    }
 
-int main() {
     string img_filename;
     int scalar;
     cout << "File name:" << endl;
     cin >> img_filename;
     
-    int width, height;
-    vector<unsigned char> image;
-    bool success = load_image(image, img_filename, width, height);
+    MappedFile file;
+    ImageBuffer image;
+    ImageView view;
+    bool success = load_image(file, image, view, img_filename);
     if (!success) {
         cout << "Error loading image\n";
         return 1;
     }
 
-    cout << "Input image dimensions:" << endl << width << " x " << height << endl;
+    cout << "Input image dimensions:" << endl << view.width << " x " << view.height << endl;
     cout << "Image downscaling factor:" << endl;
-    cin >> scalar;
-    
-    string ascii_lumenance = " `.-':_,^=;><+!rc*/z?sLTv)J7(|Fi{C}fI31tlu[neoZ5Yxjya]2ESwqkP6h9d4VpOGbUAKXHm8RD#$Bg0MNWQ%&@";
+    if (!(cin >> scalar)) {
+        cout << "Error reading the downscaling factor\n";
+        return 1;
+    }
+    if (scalar < 1) {
+        cout << "Scale must be at least 1\n";
+        return 1;
+    }
+    if (scalar > max_block_scale) {
+        cout << "Scale must be at most " << max_block_scale << "\n";
+        return 1;
+    }
     
-    image_to_ascii(image, width, height, scalar, ascii_lumenance);
+    ThreadPool pool;
+    LumaPlane plane(view);
+    if (plane.empty()) {
+        cout << "Out of memory\n";
+        return 1;
+    }
+    WriteStats written;
+    if (!image_to_ascii(plane, scalar, default_glyphs, "output.txt", &pool, written)) {
+        cout << "Error writing output.txt\n";
+        return 1;
+    }
+    cout << "Wrote " << written.bytes << " bytes to output.txt in " << written.syscalls << " write calls" << endl;
 
     return 0;
-}
\ No newline at end of file
+}
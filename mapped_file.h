@@ -0,0 +1,114 @@
+/**
+ * @brief Whole-file input, memory mapped where possible
+ *
+ * Decoders get the file as one contiguous span so stb_image can work from
+ * memory instead of refilling a 128-byte stdio buffer. When the file cannot
+ * be mapped (pipes, some network filesystems) it is read in a single pass.
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cerrno>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+class MappedFile {
+public:
+    MappedFile() : map_(nullptr), size_(0) {}
+
+    explicit MappedFile(const std::string& filename) : map_(nullptr), size_(0) {
+        open(filename);
+    }
+
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& filename) {
+        close();
+        int fd = ::open(filename.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+
+        struct stat info;
+        bool regular = fstat(fd, &info) == 0 && S_ISREG(info.st_mode);
+        bool ok = false;
+        if (regular && info.st_size > 0) {
+            void* map = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+            if (map != MAP_FAILED) {
+                madvise(map, static_cast<size_t>(info.st_size), MADV_SEQUENTIAL);
+                map_ = static_cast<unsigned char*>(map);
+                size_ = static_cast<size_t>(info.st_size);
+                ok = true;
+            }
+        }
+        if (!ok) {
+            ok = read_all(fd, regular ? static_cast<size_t>(info.st_size) : 0);
+        }
+        ::close(fd);
+        return ok;
+    }
+
+    void close() {
+        if (map_ != nullptr) {
+            munmap(map_, size_);
+            map_ = nullptr;
+        }
+        std::vector<unsigned char>().swap(copy_);
+        size_ = 0;
+    }
+
+    const unsigned char* data() const { return map_ != nullptr ? map_ : copy_.data(); }
+    size_t size() const { return size_; }
+    bool is_mapped() const { return map_ != nullptr; }
+
+private:
+    // size_hint is the stat size for regular files; anything else grows as it reads.
+    bool read_all(int fd, size_t size_hint) {
+        copy_.resize(size_hint > 0 ? size_hint : (1 << 20));
+        size_t used = 0;
+        for (;;) {
+            ssize_t got;
+            if (used < copy_.size()) {
+                got = ::read(fd, copy_.data() + used, copy_.size() - used);
+            } else {
+                // only grow once the buffer is full and there is really more to come
+                unsigned char next;
+                got = ::read(fd, &next, 1);
+                if (got == 1) {
+                    copy_.resize(copy_.size() * 2);
+                    copy_[used] = next;
+                }
+            }
+            if (got < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                copy_.clear();
+                return false;
+            }
+            if (got == 0) {
+                break;
+            }
+            used += static_cast<size_t>(got);
+        }
+        copy_.resize(used);
+        size_ = used;
+        return used > 0;
+    }
+
+    unsigned char* map_;
+    size_t size_;
+    std::vector<unsigned char> copy_;
+};
+
+#endif
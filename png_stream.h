@@ -0,0 +1,291 @@
+/**
+ * @brief Row-at-a-time PNG decoding straight into a luminance sink
+ *
+ * stb_image gathers every IDAT chunk into one buffer, inflates all of it and
+ * only then unfilters, so a big PNG briefly exists three times over. Here the
+ * IDAT chunks are inflated in place in the mapped file as rows are needed,
+ * each row is unfiltered against the one before it, and its luminance goes to
+ * the sink before the next row is decoded. Pixel values come out exactly as
+ * stb_image's single-channel conversion would produce them.
+ */
+
+#ifndef PNG_STREAM_H
+#define PNG_STREAM_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <utility>
+#include <vector>
+
+#include "inflate_stream.h"
+
+struct PngHeader {
+    uint32_t width = 0;
+    uint32_t height = 0;
+    int depth = 0;
+    int color = 0;
+    int channels = 0;
+    const unsigned char* palette = nullptr;
+    int palette_size = 0;
+};
+
+static uint32_t png_u32(const unsigned char* p) {
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+static bool png_chunk_is(const unsigned char* chunk, const char* type) {
+    return memcmp(chunk + 4, type, 4) == 0;
+}
+
+// Reads the chunks ahead of the first IDAT and leaves `at` on it. False for
+// anything this path leaves to stb_image: interlaced or Apple CgBI files,
+// odd headers, damaged chunk lengths.
+static bool png_stream_header(const unsigned char* bytes, size_t len, PngHeader& header, size_t& at) {
+    static const unsigned char signature[8] = {137, 80, 78, 71, 13, 10, 26, 10};
+    if (len < 8 || memcmp(bytes, signature, 8) != 0) {
+        return false;
+    }
+
+    bool have_header = false;
+    for (at = 8; at + 12 <= len; ) {
+        const unsigned char* chunk = bytes + at;
+        size_t length = png_u32(chunk);
+        if (length > len - at - 12) {
+            return false;
+        }
+        const unsigned char* data = chunk + 8;
+
+        if (png_chunk_is(chunk, "IHDR")) {
+            if (have_header || length != 13) {
+                return false;
+            }
+            have_header = true;
+            header.width = png_u32(data);
+            header.height = png_u32(data + 4);
+            header.depth = data[8];
+            header.color = data[9];
+            if (data[10] != 0 || data[11] != 0 || data[12] != 0) {
+                return false;
+            }
+        } else if (png_chunk_is(chunk, "PLTE")) {
+            header.palette = data;
+            header.palette_size = static_cast<int>(length / 3);
+        } else if (png_chunk_is(chunk, "CgBI") || png_chunk_is(chunk, "IEND")) {
+            return false;
+        } else if (png_chunk_is(chunk, "IDAT")) {
+            break;
+        }
+        at += length + 12;
+    }
+    if (!have_header || at + 12 > len) {
+        return false;
+    }
+    if (header.width == 0 || header.height == 0 || header.width > (1 << 24) || header.height > (1 << 24)) {
+        return false;
+    }
+
+    int d = header.depth;
+    switch (header.color) {
+        case 0: header.channels = 1; return d == 1 || d == 2 || d == 4 || d == 8 || d == 16;
+        case 2: header.channels = 3; return d == 8 || d == 16;
+        case 3: header.channels = 1; return (d == 1 || d == 2 || d == 4 || d == 8) && header.palette_size > 0;
+        case 4: header.channels = 2; return d == 8 || d == 16;
+        case 6: header.channels = 4; return d == 8 || d == 16;
+        default: return false;
+    }
+}
+
+static int png_paeth(int a, int b, int c) {
+    int p = a + b - c;
+    int pa = abs(p - a);
+    int pb = abs(p - b);
+    int pc = abs(p - c);
+    if (pa <= pb && pa <= pc) {
+        return a;
+    }
+    return pb <= pc ? b : c;
+}
+
+// Undoes the row filter in place. prior is the previous unfiltered row, all
+// zeros for the first one. bpp is whole bytes per pixel, at least 1.
+static bool png_unfilter(unsigned char* row, const unsigned char* prior, size_t bytes, size_t bpp, int filter) {
+    switch (filter) {
+        case 0:
+            break;
+        case 1:
+            for (size_t i = bpp; i < bytes; i++) {
+                row[i] = static_cast<unsigned char>(row[i] + row[i - bpp]);
+            }
+            break;
+        case 2:
+            for (size_t i = 0; i < bytes; i++) {
+                row[i] = static_cast<unsigned char>(row[i] + prior[i]);
+            }
+            break;
+        case 3:
+            for (size_t i = 0; i < bpp; i++) {
+                row[i] = static_cast<unsigned char>(row[i] + (prior[i] >> 1));
+            }
+            for (size_t i = bpp; i < bytes; i++) {
+                row[i] = static_cast<unsigned char>(row[i] + ((prior[i] + row[i - bpp]) >> 1));
+            }
+            break;
+        case 4:
+            for (size_t i = 0; i < bpp; i++) {
+                row[i] = static_cast<unsigned char>(row[i] + prior[i]);
+            }
+            for (size_t i = bpp; i < bytes; i++) {
+                row[i] = static_cast<unsigned char>(row[i] + png_paeth(row[i - bpp], prior[i], prior[i - bpp]));
+            }
+            break;
+        default:
+            return false;
+    }
+    return true;
+}
+
+// stb_image's RGB to gray weights
+static unsigned char png_compute_y(int r, int g, int b) {
+    return static_cast<unsigned char>((r * 77 + g * 150 + b * 29) >> 8);
+}
+
+// 16-bit samples are weighted at full precision and then cut to 8 bits, as
+// stb_image does when asked for 8-bit gray.
+static unsigned char png_compute_y16(const unsigned char* p) {
+    int r = (p[0] << 8) | p[1];
+    int g = (p[2] << 8) | p[3];
+    int b = (p[4] << 8) | p[5];
+    return static_cast<unsigned char>(((r * 77 + g * 150 + b * 29) >> 8) >> 8);
+}
+
+// Converts one unfiltered row. palette_luma is only used for indexed images.
+static void png_row_luma(const PngHeader& header, const unsigned char* row, const unsigned char* palette_luma, unsigned char* luma) {
+    const uint32_t width = header.width;
+    const int depth = header.depth;
+    if (depth < 8) {
+        // grey levels are stretched to 0..255, palette indices are not
+        static const unsigned char stretch[9] = {0, 0xff, 0x55, 0, 0x11, 0, 0, 0, 0x01};
+        const int mask = (1 << depth) - 1;
+        for (uint32_t x = 0; x < width; x++) {
+            size_t bit = static_cast<size_t>(x) * depth;
+            int value = (row[bit >> 3] >> (8 - depth - (bit & 7))) & mask;
+            luma[x] = header.color == 3 ? palette_luma[value] : static_cast<unsigned char>(value * stretch[depth]);
+        }
+        return;
+    }
+
+    const int sample = depth / 8;
+    const int pixel = header.channels * sample;
+    switch (header.color) {
+        case 0:
+        case 4:
+            // the high byte of a 16-bit sample comes first
+            for (uint32_t x = 0; x < width; x++) {
+                luma[x] = row[static_cast<size_t>(x) * pixel];
+            }
+            break;
+        case 3:
+            for (uint32_t x = 0; x < width; x++) {
+                luma[x] = palette_luma[row[x]];
+            }
+            break;
+        default:
+            for (uint32_t x = 0; x < width; x++) {
+                const unsigned char* p = row + static_cast<size_t>(x) * pixel;
+                luma[x] = sample == 1 ? png_compute_y(p[0], p[1], p[2]) : png_compute_y16(p);
+            }
+            break;
+    }
+}
+
+// Streams the luminance of a non-interlaced PNG into sink: sink.start(width,
+// height, 1) once, then sink.row(luma) per scanline. Holds two filtered rows
+// and the inflate window, never the image. `unsupported` is set, before
+// anything reaches sink, for input this path does not handle.
+template <class Sink>
+static int png_stream_luma(const unsigned char* bytes, size_t len, Sink& sink, bool* unsupported) {
+    PngHeader header;
+    size_t at = 0;
+    *unsupported = !png_stream_header(bytes, len, header, at);
+    if (*unsupported) {
+        return 0;
+    }
+
+    unsigned char palette_luma[256] = {0};
+    for (int i = 0; i < header.palette_size && i < 256; i++) {
+        const unsigned char* rgb = header.palette + 3 * i;
+        palette_luma[i] = png_compute_y(rgb[0], rgb[1], rgb[2]);
+    }
+
+    // IDAT data is handed over chunk by chunk, skipping whatever sits between
+    InflateStream inflate([bytes, len, &at](const unsigned char*& data, size_t& size) {
+        while (at + 12 <= len) {
+            const unsigned char* chunk = bytes + at;
+            size_t length = png_u32(chunk);
+            if (length > len - at - 12 || png_chunk_is(chunk, "IEND")) {
+                return false;
+            }
+            at += length + 12;
+            if (png_chunk_is(chunk, "IDAT") && length > 0) {
+                data = chunk + 8;
+                size = length;
+                return true;
+            }
+        }
+        return false;
+    });
+
+    const size_t bits = static_cast<size_t>(header.width) * header.channels * header.depth;
+    const size_t row_bytes = (bits + 7) / 8;
+    const size_t bpp = header.depth < 8 ? 1 : static_cast<size_t>(header.channels) * header.depth / 8;
+    std::vector<unsigned char> rows(2 * (row_bytes + 1), 0);
+    std::vector<unsigned char> luma(header.width);
+    unsigned char* prior = rows.data() + 1;
+    unsigned char* current = rows.data() + row_bytes + 2;
+
+    sink.start(static_cast<int>(header.width), static_cast<int>(header.height), 1);
+    for (uint32_t y = 0; y < header.height; y++) {
+        if (!inflate.read(current - 1, row_bytes + 1) || !png_unfilter(current, prior, row_bytes, bpp, current[-1])) {
+            return 0;
+        }
+        png_row_luma(header, current, palette_luma, luma.data());
+        sink.row(luma.data());
+        std::swap(prior, current);
+    }
+    return 1;
+}
+
+// Gathers streamed rows into one plane, allocated the way stb_image's are.
+struct PngPlaneSink {
+    unsigned char* plane = nullptr;
+    size_t width = 0;
+    size_t rows = 0;
+
+    void start(int w, int h, int) {
+        width = static_cast<size_t>(w);
+        plane = static_cast<unsigned char*>(STBI_MALLOC(width * static_cast<size_t>(h)));
+    }
+
+    void row(const unsigned char* luma) {
+        if (plane != nullptr) {
+            memcpy(plane + width * rows++, luma, width);
+        }
+    }
+};
+
+// Whole-image counterpart of png_stream_luma; the plane is freed with
+// stbi_image_free. Returns NULL on failure, with `unsupported` as there.
+static unsigned char* png_decode_luma(const unsigned char* bytes, size_t len, int* x, int* y, bool* unsupported) {
+    PngPlaneSink sink;
+    if (!png_stream_luma(bytes, len, sink, unsupported) || sink.plane == nullptr) {
+        STBI_FREE(sink.plane);
+        return nullptr;
+    }
+    *x = static_cast<int>(sink.width);
+    *y = static_cast<int>(sink.rows);
+    return sink.plane;
+}
+
+#endif
@@ -0,0 +1,130 @@
+/**
+ * @brief In-place views of uncompressed PPM/PGM, BMP and TGA rasters
+ *
+ * These files are already an array of pixels, so instead of having stb_image
+ * copy them into an RGBA buffer the renderer reads them where they lie in the
+ * mapped file. Rows can run bottom-up (a negative stride) and BMP/TGA keep
+ * their blue-green-red order, which the view records. Needs the stb_image
+ * implementation in the same translation unit.
+ */
+
+#ifndef RAW_IMAGE_H
+#define RAW_IMAGE_H
+
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+
+#include "image_buffer.h"
+#include "image_format.h"
+
+static uint32_t raw_u16(const unsigned char* p) {
+    return p[0] | (uint32_t(p[1]) << 8);
+}
+
+static uint32_t raw_u32(const unsigned char* p) {
+    return raw_u16(p) | (raw_u16(p + 2) << 16);
+}
+
+// Points view at rows of `row_bytes` starting at offset `at`, if they fit.
+static bool raw_rows(const unsigned char* bytes, size_t len, size_t at, size_t row_bytes, bool bottom_up, ImageView& view) {
+    size_t height = static_cast<size_t>(view.height);
+    if (view.width <= 0 || view.height <= 0 || at > len || row_bytes > (len - at) / height) {
+        return false;
+    }
+    const unsigned char* first = bytes + at;
+    if (bottom_up) {
+        view.pixels = first + row_bytes * (height - 1);
+        view.stride = -static_cast<ptrdiff_t>(row_bytes);
+    } else {
+        view.pixels = first;
+        view.stride = static_cast<ptrdiff_t>(row_bytes);
+    }
+    return true;
+}
+
+// Binary 8-bit PGM (P5) and PPM (P6); stb_image's own header parser finds
+// where the pixels start.
+static bool raw_pnm_view(const unsigned char* bytes, size_t len, ImageView& view) {
+    stbi__context s;
+    stbi__start_mem(&s, bytes, static_cast<int>(len));
+    int x, y, channels;
+    if (stbi__pnm_info(&s, &x, &y, &channels) != 8) {
+        return false;
+    }
+    view.width = x;
+    view.height = y;
+    view.channels = channels;
+    return raw_rows(bytes, len, static_cast<size_t>(s.img_buffer - bytes), static_cast<size_t>(x) * channels, false, view);
+}
+
+// Uncompressed (BI_RGB) 24 and 32-bit BMPs. Rows are padded to four bytes and
+// run bottom-up unless the height is negative.
+static bool raw_bmp_view(const unsigned char* bytes, size_t len, ImageView& view) {
+    if (len < 54 || bytes[0] != 'B' || bytes[1] != 'M') {
+        return false;
+    }
+    uint32_t header = raw_u32(bytes + 14);
+    if ((header != 40 && header != 56 && header != 108 && header != 124) || raw_u16(bytes + 26) != 1) {
+        return false;
+    }
+    int32_t width = static_cast<int32_t>(raw_u32(bytes + 18));
+    int32_t height = static_cast<int32_t>(raw_u32(bytes + 22));
+    uint32_t bpp = raw_u16(bytes + 28);
+    if (raw_u32(bytes + 30) != 0 || (bpp != 24 && bpp != 32) || height == INT32_MIN || width > (1 << 24)) {
+        return false;
+    }
+    view.width = width;
+    view.height = height < 0 ? -height : height;
+    view.channels = static_cast<int>(bpp / 8);
+    view.bgr = true;
+    size_t row_bytes = (static_cast<size_t>(width < 0 ? 0 : width) * view.channels + 3) & ~size_t(3);
+    return raw_rows(bytes, len, raw_u32(bytes + 10), row_bytes, height > 0, view);
+}
+
+// Uncompressed true-colour (24/32-bit) and grey (8-bit) TGAs without a colour
+// map. Rows run bottom-up unless the descriptor says otherwise.
+static bool raw_tga_view(const unsigned char* bytes, size_t len, ImageView& view) {
+    if (len < 18 || bytes[1] != 0) {
+        return false;
+    }
+    int type = bytes[2];
+    int bpp = bytes[16];
+    int descriptor = bytes[17];
+    bool truecolor = type == 2 && (bpp == 24 || bpp == 32);
+    bool grey = type == 3 && bpp == 8;
+    if ((!truecolor && !grey) || (descriptor & 0x10)) {
+        return false;
+    }
+    view.width = static_cast<int>(raw_u16(bytes + 12));
+    view.height = static_cast<int>(raw_u16(bytes + 14));
+    view.channels = bpp / 8;
+    view.bgr = truecolor;
+    return raw_rows(bytes, len, 18 + bytes[0], static_cast<size_t>(view.width) * view.channels, !(descriptor & 0x20), view);
+}
+
+// Fills view with the pixels of an uncompressed raster in bytes, which must
+// outlive it. False for anything that needs decoding. TGA has no signature,
+// so without a hint it is only tried where stb_image would try it.
+inline bool raw_image_view(const unsigned char* bytes, size_t len, ImageView& view, ImageFormat format = ImageFormat::Unknown) {
+    if (len > INT_MAX) {
+        return false;
+    }
+    if (format == ImageFormat::Unknown) {
+        format = sniff_image_format(bytes, len);
+        if (format == ImageFormat::Unknown) {
+            stbi__context s;
+            stbi__start_mem(&s, bytes, static_cast<int>(len));
+            format = stbi__tga_test(&s) ? ImageFormat::Tga : ImageFormat::Unknown;
+        }
+    }
+
+    switch (format) {
+        case ImageFormat::Pnm: return raw_pnm_view(bytes, len, view);
+        case ImageFormat::Bmp: return raw_bmp_view(bytes, len, view);
+        case ImageFormat::Tga: return raw_tga_view(bytes, len, view);
+        default: return false;
+    }
+}
+
+#endif
@@ -0,0 +1,486 @@
+/**
+ * @brief Request/response framing for the render daemon's Unix socket
+ *
+ * A request is a run of fields, each `name length\n` followed by exactly
+ * that many raw bytes, closed by `render 0\n`. Lengths make every value
+ * binary safe, so palettes may hold spaces and images travel inline. The
+ * answer is `ok length\n` and the rendered text, or `error length\n` and a
+ * message. A connection can carry any number of requests back to back.
+ * `format` names the input's image format; `output` names the answer's,
+ * and only `text` (rows of doubled glyphs) exists so far.
+ *
+ * For shared memory a request may carry a `memfd` field, whose descriptor
+ * rides along as SCM_RIGHTS, and then describe its frame and text slot as
+ * offsets into it; the answer to those is `shm length\n` and the text size.
+ */
+
+#ifndef RENDER_PROTOCOL_H
+#define RENDER_PROTOCOL_H
+
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Pixels in the shared memory: 1 (luma), 3 or 4 (RGBA) channels, top row first.
+struct SharedFrame {
+    size_t offset = 0;
+    int width = 0;
+    int height = 0;
+    int channels = 0;
+    size_t stride = 0;
+};
+
+// Where in the shared memory the text goes, and how much room there is.
+struct SharedSlot {
+    size_t offset = 0;
+    size_t capacity = 0;
+};
+
+struct RenderRequest {
+    std::string path;     // file to render, as the daemon sees it
+    std::string data;     // or the image itself
+    int scalar = 0;       // downscaling factor, 0 for the daemon's default
+    std::string palette;  // empty for the daemon's default
+    std::string format;   // input format name, empty to sniff
+    std::string model;    // luminance model name, empty for mean
+    std::string output;   // output format name, empty for text
+
+    int memfd = -1;       // shared memory handed over with this request
+    bool shared_frame = false;
+    SharedFrame frame;
+    bool shared_reply = false;
+    SharedSlot reply;
+};
+
+// Where the daemon listens unless told otherwise.
+const char* const render_default_socket = "/tmp/ascii-artd.sock";
+
+// Largest inline image or response the framing accepts; other fields are
+// held to far less (render_request_limit).
+const size_t render_max_payload = size_t(1) << 30;
+
+inline bool write_all(int fd, const char* data, size_t size) {
+    while (size > 0) {
+        ssize_t written = ::send(fd, data, size, MSG_NOSIGNAL);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += written;
+        size -= static_cast<size_t>(written);
+    }
+    return true;
+}
+
+// Buffered reads off a socket, so headers do not cost a syscall per byte.
+// At most one descriptor passed along with the data is held for the caller;
+// a peer that sends another before that one is taken, or several at once,
+// is treated as broken and every read after that fails.
+class SocketReader {
+public:
+    explicit SocketReader(int fd) : fd_(fd), begin_(0), end_(0), pending_fd_(-1), broken_(false) {}
+
+    ~SocketReader() {
+        if (pending_fd_ >= 0) {
+            ::close(pending_fd_);
+        }
+    }
+
+    SocketReader(const SocketReader&) = delete;
+    SocketReader& operator=(const SocketReader&) = delete;
+
+    // The descriptor passed along with the data read so far, or -1. The
+    // caller owns it.
+    int take_fd() {
+        int fd = pending_fd_;
+        pending_fd_ = -1;
+        return fd;
+    }
+
+    // A line without its newline. False at end of input or past max bytes.
+    bool read_line(std::string& line, size_t max) {
+        line.clear();
+        for (;;) {
+            if (begin_ == end_ && !fill()) {
+                return false;
+            }
+            const char* start = buffer_ + begin_;
+            const char* newline = static_cast<const char*>(memchr(start, '\n', end_ - begin_));
+            size_t take = newline != nullptr ? static_cast<size_t>(newline - start) : end_ - begin_;
+            if (line.size() + take > max) {
+                return false;
+            }
+            line.append(start, take);
+            begin_ += take;
+            if (newline != nullptr) {
+                begin_++;
+                return true;
+            }
+        }
+    }
+
+    // out grows as the bytes arrive, a chunk at a time, so a length that is
+    // never followed by data costs no memory.
+    bool read_exact(std::string& out, size_t size) {
+        out.clear();
+        size_t have = 0;
+        while (have < size) {
+            if (have == out.size()) {
+                out.resize(have + std::min(size - have, std::max(have, sizeof(buffer_))));
+            }
+            if (begin_ == end_) {
+                // big payloads skip the buffer
+                if (out.size() - have >= sizeof(buffer_)) {
+                    ssize_t got = ::read(fd_, &out[have], out.size() - have);
+                    if (got < 0 && errno == EINTR) {
+                        continue;
+                    }
+                    if (got <= 0) {
+                        return false;
+                    }
+                    have += static_cast<size_t>(got);
+                    continue;
+                }
+                if (!fill()) {
+                    return false;
+                }
+            }
+            size_t take = std::min(out.size() - have, end_ - begin_);
+            memcpy(&out[have], buffer_ + begin_, take);
+            begin_ += take;
+            have += take;
+        }
+        return true;
+    }
+
+private:
+    // recvmsg rather than read, to pick up any descriptors sent with the bytes
+    bool fill() {
+        if (broken_) {
+            return false;
+        }
+        for (;;) {
+            iovec span = {buffer_, sizeof(buffer_)};
+            alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))];
+            msghdr message = {};
+            message.msg_iov = &span;
+            message.msg_iovlen = 1;
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            ssize_t got = ::recvmsg(fd_, &message, MSG_CMSG_CLOEXEC);
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            // descriptors that did not fit were closed by the kernel
+            broken_ = got >= 0 && (message.msg_flags & MSG_CTRUNC) != 0;
+            for (cmsghdr* c = CMSG_FIRSTHDR(&message); got >= 0 && c != nullptr; c = CMSG_NXTHDR(&message, c)) {
+                if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_RIGHTS) {
+                    size_t count = (c->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+                    for (size_t i = 0; i < count; i++) {
+                        int fd;
+                        memcpy(&fd, CMSG_DATA(c) + i * sizeof(int), sizeof(int));
+                        if (pending_fd_ >= 0) {
+                            ::close(fd);
+                            broken_ = true;
+                        } else {
+                            pending_fd_ = fd;
+                        }
+                    }
+                }
+            }
+            begin_ = 0;
+            end_ = got > 0 && !broken_ ? static_cast<size_t>(got) : 0;
+            return end_ > 0;
+        }
+    }
+
+    int fd_;
+    char buffer_[16384];
+    size_t begin_;
+    size_t end_;
+    int pending_fd_;
+    bool broken_;
+};
+
+static void render_add_field(std::string& out, const char* name, const std::string& value) {
+    out += name;
+    out += ' ';
+    out += std::to_string(value.size());
+    out += '\n';
+    out += value;
+}
+
+// Splits `name length` and reads the value that follows, if it is no longer
+// than limit says values of that name may be.
+static bool render_read_field(SocketReader& in, std::string& name, std::string& value, size_t (*limit)(const std::string&)) {
+    std::string line;
+    if (!in.read_line(line, 64)) {
+        return false;
+    }
+    size_t space = line.find(' ');
+    if (space == std::string::npos || space + 1 >= line.size()) {
+        return false;
+    }
+    char* end = nullptr;
+    unsigned long long size = strtoull(line.c_str() + space + 1, &end, 10);
+    name = line.substr(0, space);
+    if (*end != '\0' || size > limit(name)) {
+        return false;
+    }
+    return in.read_exact(value, static_cast<size_t>(size));
+}
+
+// Only inline images are large; every other request field is a short string
+// or a few numbers, and is held to that.
+static size_t render_request_limit(const std::string& name) {
+    if (name == "data") {
+        return render_max_payload;
+    }
+    if (name == "path") {
+        return PATH_MAX;
+    }
+    if (name == "palette") {
+        return 256;
+    }
+    return 128;
+}
+
+static size_t render_response_limit(const std::string&) {
+    return render_max_payload;
+}
+
+// Sends data with fd attached to its first byte.
+static bool send_with_fd(int socket, const std::string& data, int fd) {
+    iovec span = {const_cast<char*>(data.data()), data.size()};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(int))] = {};
+    msghdr message = {};
+    message.msg_iov = &span;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+    cmsghdr* c = CMSG_FIRSTHDR(&message);
+    c->cmsg_level = SOL_SOCKET;
+    c->cmsg_type = SCM_RIGHTS;
+    c->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(c), &fd, sizeof(int));
+
+    ssize_t sent;
+    do {
+        sent = ::sendmsg(socket, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent > 0 && write_all(socket, data.data() + sent, data.size() - static_cast<size_t>(sent));
+}
+
+inline bool send_render_request(int fd, const RenderRequest& request) {
+    std::string header;
+    if (request.memfd >= 0) {
+        render_add_field(header, "memfd", "");
+    }
+    if (!request.path.empty()) {
+        render_add_field(header, "path", request.path);
+    }
+    if (request.shared_frame) {
+        const SharedFrame& frame = request.frame;
+        render_add_field(header, "frame", std::to_string(frame.offset) + " " + std::to_string(frame.width) + " " +
+                                              std::to_string(frame.height) + " " + std::to_string(frame.channels) + " " +
+                                              std::to_string(frame.stride));
+    }
+    if (request.shared_reply) {
+        render_add_field(header, "reply", std::to_string(request.reply.offset) + " " + std::to_string(request.reply.capacity));
+    }
+    if (request.scalar != 0) {
+        render_add_field(header, "scale", std::to_string(request.scalar));
+    }
+    if (!request.palette.empty()) {
+        render_add_field(header, "palette", request.palette);
+    }
+    if (!request.format.empty()) {
+        render_add_field(header, "format", request.format);
+    }
+    if (!request.model.empty()) {
+        render_add_field(header, "model", request.model);
+    }
+    if (!request.output.empty()) {
+        render_add_field(header, "output", request.output);
+    }
+    if (!request.data.empty()) {
+        header += "data " + std::to_string(request.data.size()) + "\n";
+    }
+    bool sent = request.memfd >= 0 ? send_with_fd(fd, header, request.memfd) : write_all(fd, header.data(), header.size());
+    // inline bytes go straight from the caller's buffer
+    return sent && write_all(fd, request.data.data(), request.data.size()) && write_all(fd, "render 0\n", 9);
+}
+
+// Reads whitespace-separated decimal numbers; false unless all of them are there.
+static bool render_parse_numbers(const std::string& text, unsigned long long* numbers, int count) {
+    const char* at = text.c_str();
+    for (int i = 0; i < count; i++) {
+        char* end = nullptr;
+        errno = 0;
+        numbers[i] = strtoull(at, &end, 10);
+        if (end == at || errno != 0) {
+            return false;
+        }
+        at = end;
+    }
+    return *at == '\0';
+}
+
+// False at a clean end of input or on a malformed request; either way the
+// connection is done. A descriptor left in request.memfd belongs to the caller.
+inline bool read_render_request(SocketReader& in, RenderRequest& request) {
+    request = RenderRequest();
+    std::string name;
+    std::string value;
+    unsigned long long numbers[5];
+    while (render_read_field(in, name, value, render_request_limit)) {
+        if (name == "render") {
+            return true;
+        } else if (name == "memfd") {
+            if (request.memfd >= 0) {
+                ::close(request.memfd);
+            }
+            request.memfd = in.take_fd();
+        } else if (name == "frame" || name == "reply") {
+            bool frame = name == "frame";
+            if (!render_parse_numbers(value, numbers, frame ? 5 : 2)) {
+                break;
+            }
+            if (frame) {
+                if (numbers[1] > INT_MAX || numbers[2] > INT_MAX || numbers[3] > 4) {
+                    break;
+                }
+                request.shared_frame = true;
+                request.frame.offset = static_cast<size_t>(numbers[0]);
+                request.frame.width = static_cast<int>(numbers[1]);
+                request.frame.height = static_cast<int>(numbers[2]);
+                request.frame.channels = static_cast<int>(numbers[3]);
+                request.frame.stride = static_cast<size_t>(numbers[4]);
+            } else {
+                request.shared_reply = true;
+                request.reply.offset = static_cast<size_t>(numbers[0]);
+                request.reply.capacity = static_cast<size_t>(numbers[1]);
+            }
+        } else if (name == "path") {
+            request.path.swap(value);
+        } else if (name == "data") {
+            request.data.swap(value);
+        } else if (name == "scale") {
+            request.scalar = atoi(value.c_str());
+        } else if (name == "palette") {
+            request.palette.swap(value);
+        } else if (name == "format") {
+            request.format.swap(value);
+        } else if (name == "model") {
+            request.model.swap(value);
+        } else if (name == "output") {
+            request.output.swap(value);
+        }
+        // unknown fields are skipped so older daemons tolerate newer clients
+    }
+    if (request.memfd >= 0) {
+        ::close(request.memfd);
+        request.memfd = -1;
+    }
+    return false;
+}
+
+// ok says whether body is rendered text or an error message. For a shared
+// reply slot body is the decimal size of the text left there.
+inline bool read_render_response(SocketReader& in, bool& ok, std::string& body) {
+    std::string name;
+    if (!render_read_field(in, name, body, render_response_limit) || (name != "ok" && name != "error" && name != "shm")) {
+        return false;
+    }
+    ok = name != "error";
+    return true;
+}
+
+inline std::string render_response_header(bool ok, size_t size) {
+    return (ok ? "ok " : "error ") + std::to_string(size) + "\n";
+}
+
+// The whole answer to a request whose text went into a shared slot.
+inline std::string render_shared_response(size_t size) {
+    std::string digits = std::to_string(size);
+    return "shm " + std::to_string(digits.size()) + "\n" + digits;
+}
+
+static bool render_socket_address(const std::string& path, sockaddr_un& address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    memcpy(address.sun_path, path.c_str(), path.size() + 1);
+    return true;
+}
+
+inline int connect_render_socket(const std::string& path) {
+    sockaddr_un address;
+    if (!render_socket_address(path, address)) {
+        return -1;
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+// Binds path and listens. -1 on failure, with errno set. Whatever is at path
+// already is only replaced when it is a socket nobody answers on, the remains
+// of a daemon that did not clean up; a live daemon's socket fails with
+// EADDRINUSE and anything that is not a socket with EEXIST.
+inline int listen_render_socket(const std::string& path) {
+    sockaddr_un address;
+    if (!render_socket_address(path, address)) {
+        return -1;
+    }
+    struct stat existing;
+    if (::lstat(path.c_str(), &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            errno = EEXIST;
+            return -1;
+        }
+        int live = connect_render_socket(path);
+        if (live >= 0) {
+            ::close(live);
+            errno = EADDRINUSE;
+            return -1;
+        }
+        if (errno != ECONNREFUSED || ::unlink(path.c_str()) != 0) {
+            return -1;
+        }
+    }
+    int fd = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || ::listen(fd, SOMAXCONN) != 0) {
+        int saved = errno;
+        ::close(fd);
+        errno = saved;
+        return -1;
+    }
+    return fd;
+}
+
+#endif
@@ -0,0 +1,88 @@
+/**
+ * @brief Block reduction specialised on the scale factor
+ *
+ * BlockScale<N> knows its block size at compile time, so the per-block pixel
+ * loop unrolls and the divide by N * N becomes a multiply and shift.
+ * BlockScale<0> is the fallback for any other scale and does the same with a
+ * reciprocal worked out once at construction. dispatch_block_scale() picks
+ * the right one for a runtime scalar.
+ */
+
+#ifndef SCALE_KERNELS_H
+#define SCALE_KERNELS_H
+
+#include <cstdint>
+
+// Block sums are uint32_t and reach 255 * scale * scale, which stays below
+// 2^32 up to here; callers refuse larger scales.
+const int max_block_scale = 4096;
+
+template <int Scalar>
+struct BlockScale {
+    explicit BlockScale(int) {}
+
+    int size() const { return Scalar; }
+
+    uint32_t row_sum(const unsigned char* pixels) const {
+        uint32_t sum = 0;
+#pragma GCC unroll 16
+        for (int k = 0; k < Scalar; k++) {
+            sum += pixels[k];
+        }
+        return sum;
+    }
+
+    uint32_t average(uint32_t block_sum) const {
+        return block_sum / static_cast<uint32_t>(Scalar * Scalar);
+    }
+};
+
+template <>
+struct BlockScale<0> {
+    // (sum * reciprocal) >> 32 with reciprocal = 2^32 / area + 1 is exact while
+    // sum * area < 2^32; block sums top out at 255 * area, so that holds for
+    // every scale below 64 and larger ones use a plain divide.
+    explicit BlockScale(int scalar)
+        : scalar_(scalar), area_(uint32_t(scalar) * uint32_t(scalar)),
+          reciprocal_(scalar < 64 ? (uint64_t(1) << 32) / area_ + 1 : 0) {}
+
+    int size() const { return scalar_; }
+
+    uint32_t row_sum(const unsigned char* pixels) const {
+        uint32_t sum = 0;
+        for (int k = 0; k < scalar_; k++) {
+            sum += pixels[k];
+        }
+        return sum;
+    }
+
+    uint32_t average(uint32_t block_sum) const {
+        if (reciprocal_ == 0) {
+            return block_sum / area_;
+        }
+        return static_cast<uint32_t>((block_sum * reciprocal_) >> 32);
+    }
+
+private:
+    int scalar_;
+    uint32_t area_;
+    uint64_t reciprocal_;
+};
+
+// Calls f with the BlockScale matching scalar and returns what it returns.
+template <class F>
+auto dispatch_block_scale(int scalar, F&& f) -> decltype(f(BlockScale<0>(scalar))) {
+    switch (scalar) {
+        case 1: return f(BlockScale<1>(scalar));
+        case 2: return f(BlockScale<2>(scalar));
+        case 3: return f(BlockScale<3>(scalar));
+        case 4: return f(BlockScale<4>(scalar));
+        case 6: return f(BlockScale<6>(scalar));
+        case 8: return f(BlockScale<8>(scalar));
+        case 12: return f(BlockScale<12>(scalar));
+        case 16: return f(BlockScale<16>(scalar));
+        default: return f(BlockScale<0>(scalar));
+    }
+}
+
+#endif
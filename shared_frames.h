@@ -0,0 +1,121 @@
+/**
+ * @brief memfd-backed shared memory between the render daemon and a client
+ *
+ * The client lays its decoded frames and text slots out in one sealed memfd
+ * and hands the descriptor to the daemon once; after that a request only
+ * names offsets. The daemon reads pixels and writes text in place, so frames
+ * never cross the socket. The memfd is sealed against shrinking, so the
+ * daemon cannot fault on pages the client takes away under it.
+ */
+
+#ifndef SHARED_FRAMES_H
+#define SHARED_FRAMES_H
+
+#include <cstddef>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// A whole memfd mapped read-write. Used on both ends.
+class SharedMapping {
+public:
+    SharedMapping() : base_(nullptr), size_(0) {}
+    ~SharedMapping() { unmap(); }
+
+    SharedMapping(const SharedMapping&) = delete;
+    SharedMapping& operator=(const SharedMapping&) = delete;
+
+    // Maps fd, which must be sealed against shrinking. The descriptor is not
+    // kept; the mapping holds the memory alive.
+    bool map(int fd) {
+        unmap();
+        struct stat info;
+        int seals = fcntl(fd, F_GET_SEALS);
+        if (seals < 0 || !(seals & F_SEAL_SHRINK) || fstat(fd, &info) != 0 || info.st_size <= 0) {
+            return false;
+        }
+        void* base = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (base == MAP_FAILED) {
+            return false;
+        }
+        base_ = static_cast<unsigned char*>(base);
+        size_ = static_cast<size_t>(info.st_size);
+        return true;
+    }
+
+    void unmap() {
+        if (base_ != nullptr) {
+            munmap(base_, size_);
+        }
+        base_ = nullptr;
+        size_ = 0;
+    }
+
+    bool is_mapped() const { return base_ != nullptr; }
+    size_t size() const { return size_; }
+
+    // True when [offset, offset + bytes) lies inside the mapping.
+    bool contains(size_t offset, size_t bytes) const {
+        return base_ != nullptr && offset <= size_ && bytes <= size_ - offset;
+    }
+
+    unsigned char* at(size_t offset) const { return base_ + offset; }
+
+private:
+    unsigned char* base_;
+    size_t size_;
+};
+
+// Client side: `slots` pairs of a frame buffer and a text buffer, back to
+// back in one memfd, for keeping several frames in flight.
+class SharedFrameRing {
+public:
+    SharedFrameRing() : fd_(-1), slots_(0), frame_bytes_(0), text_bytes_(0) {}
+    ~SharedFrameRing() {
+        if (fd_ >= 0) {
+            close(fd_);
+        }
+    }
+
+    SharedFrameRing(const SharedFrameRing&) = delete;
+    SharedFrameRing& operator=(const SharedFrameRing&) = delete;
+
+    bool create(size_t slots, size_t frame_bytes, size_t text_bytes) {
+        const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        slots_ = slots;
+        frame_bytes_ = (frame_bytes + page - 1) / page * page;
+        text_bytes_ = (text_bytes + page - 1) / page * page;
+
+        fd_ = memfd_create("ascii-art-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd_ < 0) {
+            return false;
+        }
+        size_t size = slots_ * (frame_bytes_ + text_bytes_);
+        return ftruncate(fd_, static_cast<off_t>(size)) == 0 &&
+               fcntl(fd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == 0 && mapping_.map(fd_);
+    }
+
+    // Handed to the daemon once, then only offsets travel.
+    int fd() const { return fd_; }
+    size_t slots() const { return slots_; }
+    size_t frame_capacity() const { return frame_bytes_; }
+    size_t text_capacity() const { return text_bytes_; }
+
+    size_t frame_offset(size_t slot) const { return slot * (frame_bytes_ + text_bytes_); }
+    size_t text_offset(size_t slot) const { return frame_offset(slot) + frame_bytes_; }
+
+    unsigned char* frame(size_t slot) const { return mapping_.at(frame_offset(slot)); }
+    const char* text(size_t slot) const { return reinterpret_cast<const char*>(mapping_.at(text_offset(slot))); }
+
+private:
+    int fd_;
+    size_t slots_;
+    size_t frame_bytes_;
+    size_t text_bytes_;
+    SharedMapping mapping_;
+};
+
+#endif
@@ -0,0 +1,131 @@
+/**
+ * @brief Turns successive rendered frames into minimal terminal updates
+ *
+ * Redrawing every cell of every frame costs the whole frame in bytes, which
+ * is what chokes a slow link at video rates. Keeping the frame on screen and
+ * comparing the next one against it, only changed cells go out, each run on a
+ * line behind one cursor-positioning escape. Short stretches of unchanged
+ * cells between two changes are resent rather than paying for a second escape.
+ */
+
+#ifndef TERMINAL_DIFF_H
+#define TERMINAL_DIFF_H
+
+#include <cstddef>
+#include <cstring>
+#include <string>
+
+class TerminalDiff {
+public:
+    TerminalDiff() : width_(0), height_(0), frames_(0), bytes_(0), full_bytes_(0) {}
+
+    // frame holds rows of equal length, each ending in '\n', as render_frame
+    // makes them. Returns everything to write for it; the reference is good
+    // until the next call. The first frame, or one of a new shape, is drawn
+    // whole on a cleared screen.
+    const std::string& update(const char* frame, size_t size) {
+        const char* newline = static_cast<const char*>(memchr(frame, '\n', size));
+        size_t width = newline != nullptr ? static_cast<size_t>(newline - frame) : size;
+        size_t height = size / (width + 1);
+
+        out_.clear();
+        if (width != width_ || height != height_ || screen_.size() != size) {
+            width_ = width;
+            height_ = height;
+            out_ += "\x1b[2J";
+            for (size_t row = 0; row < height; row++) {
+                move_to(row, 0);
+                out_.append(frame + row * (width + 1), width);
+            }
+        } else {
+            for (size_t row = 0; row < height; row++) {
+                diff_row(row, screen_.data() + row * (width + 1), frame + row * (width + 1));
+            }
+        }
+        screen_.assign(frame, size);
+
+        frames_++;
+        bytes_ += out_.size();
+        full_bytes_ += size + 3;
+        return out_;
+    }
+
+    // Forgets the screen, so the next frame is drawn whole (after a resize or
+    // anything else that may have disturbed the terminal).
+    void reset() {
+        width_ = 0;
+        height_ = 0;
+        screen_.clear();
+    }
+
+    // Moves the cursor to the line below the frame.
+    std::string park() const {
+        std::string text;
+        move_to(text, height_, 0);
+        return text;
+    }
+
+    size_t frames() const { return frames_; }
+    // Bytes update() produced, and what homing the cursor and resending every
+    // frame whole would have.
+    size_t bytes() const { return bytes_; }
+    size_t full_bytes() const { return full_bytes_; }
+
+private:
+    // A cursor escape costs about this much, so gaps up to it are cheaper to resend.
+    static const size_t merge_gap = 8;
+
+    void diff_row(size_t row, const char* was, const char* now) {
+        size_t col = 0;
+        while (col < width_) {
+            if (was[col] == now[col]) {
+                col++;
+                continue;
+            }
+            // extend the run over later changes while the gaps stay short
+            size_t begin = col;
+            size_t end = col + 1;
+            for (size_t scan = end; scan < width_ && scan - end <= merge_gap; scan++) {
+                if (was[scan] != now[scan]) {
+                    end = scan + 1;
+                }
+            }
+            move_to(row, begin);
+            out_.append(now + begin, end - begin);
+            col = end;
+        }
+    }
+
+    void move_to(size_t row, size_t col) { move_to(out_, row, col); }
+
+    // CUP is 1-based: ESC [ row ; col H
+    static void move_to(std::string& out, size_t row, size_t col) {
+        out += "\x1b[";
+        append_number(out, row + 1);
+        out += ';';
+        append_number(out, col + 1);
+        out += 'H';
+    }
+
+    static void append_number(std::string& out, size_t value) {
+        char digits[20];
+        int count = 0;
+        do {
+            digits[count++] = static_cast<char>('0' + value % 10);
+            value /= 10;
+        } while (value > 0);
+        while (count > 0) {
+            out += digits[--count];
+        }
+    }
+
+    std::string screen_;
+    std::string out_;
+    size_t width_;
+    size_t height_;
+    size_t frames_;
+    size_t bytes_;
+    size_t full_bytes_;
+};
+
+#endif
@@ -0,0 +1,93 @@
+/**
+ * @brief Checks restart-interval parallel JPEG decoding against the serial decoder
+ *
+ * With a ThreadPool, decode_image_luma splits a baseline scan at its RST
+ * markers and decodes the intervals on workers that each copy the decoder
+ * state. Builds JPEGs with restart markers (grayscale and interleaved YCbCr,
+ * several interval lengths), decodes them with and without a 4-thread pool
+ * at every reduction and requires identical planes. Truncated copies, whose
+ * marker count no longer matches the image and so fall back to the serial
+ * decoder (or, cut inside the last interval, still split), must match too.
+ *
+ * g++ -O2 -pthread tests/jpeg_parallel.cc -o jpeg_parallel && ./jpeg_parallel
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+    #define STB_IMAGE_IMPLEMENTATION
+    #include "../stb_image.h"
+}
+
+#include "../jpeg_luma.h"
+#include "../thread_pool.h"
+#include "jpeg_writer.h"
+
+using namespace std;
+
+typedef vector<unsigned char> Bytes;
+
+int failures = 0;
+
+bool same_plane(const ImageBuffer & a, const ImageBuffer & b) {
+    ImageView x = a.view();
+    ImageView y = b.view();
+    if (x.width != y.width || x.height != y.height) {
+        return false;
+    }
+    for (int row = 0; row < x.height; row++) {
+        if (memcmp(x.row(row), y.row(row), x.width) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void check(const char * name, const Bytes & file, ThreadPool & pool) {
+    for (int reduce = 1; reduce <= 8; reduce *= 2) {
+        ImageBuffer serial;
+        ImageBuffer pooled;
+        int serial_reduce = reduce;
+        int pooled_reduce = reduce;
+        bool serial_ok = decode_image_luma(serial, file.data(), static_cast<int>(file.size()), serial_reduce);
+        bool pooled_ok = decode_image_luma(pooled, file.data(), static_cast<int>(file.size()), pooled_reduce, &pool);
+
+        bool ok = serial_ok == pooled_ok && serial_reduce == pooled_reduce && (!serial_ok || same_plane(serial, pooled));
+        printf("%s %s, 1/%d: serial %s, pooled %s\n", ok ? "ok  " : "FAIL", name, reduce,
+               serial_ok ? "decoded" : "rejected", pooled_ok ? (ok ? "identical" : "different") : "rejected");
+        failures += ok ? 0 : 1;
+    }
+}
+
+unsigned char pixel(int x, int y) {
+    return static_cast<unsigned char>(((x * 11) ^ (y * 5)) + (x + y) / 3);
+}
+
+int main() {
+    ThreadPool pool(4);
+    const JpegSpec specs[] = {
+        {120, 72, 1, 1, 1, 2},
+        {120, 72, 1, 1, 7, 2},
+        {120, 72, 3, 1, 4, 2},
+        {136, 80, 3, 2, 3, 2},
+    };
+    const char * names[] = {"gray, restart 1", "gray, restart 7", "ycbcr 1x1, restart 4", "ycbcr 2x2, restart 3"};
+
+    for (int s = 0; s < 4; s++) {
+        Bytes whole = JpegWriter::encode(specs[s], pixel);
+        char name[64];
+        snprintf(name, sizeof(name), "%s, whole", names[s]);
+        check(name, whole, pool);
+        for (int percent : {40, 75, 98}) {
+            snprintf(name, sizeof(name), "%s, cut at %d%%", names[s], percent);
+            check(name, Bytes(whole.begin(), whole.begin() + whole.size() * percent / 100), pool);
+        }
+        // without its EOI the scan runs to the end of the buffer
+        snprintf(name, sizeof(name), "%s, no EOI", names[s]);
+        check(name, Bytes(whole.begin(), whole.end() - 2), pool);
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+/**
+ * @brief Bounds how far --scaled-idct planes drift from a full-size decode
+ *
+ * Each pixel of a plane decoded at 1/2, 1/4 or 1/8 size stands in for the
+ * floored mean of the block it covers in the full decode, which is what the
+ * renderer would have computed. The DC-only 1/8 path must match that to
+ * within one level with no bias (it used to round, and ran half a level
+ * bright); the reduced IDCTs ring at sharp edges, so they get a loose
+ * per-pixel bound plus tight bounds on mean and mean absolute error.
+ * Checks hello_world.jpg and a generated smooth image.
+ *
+ * g++ -O2 -pthread tests/jpeg_scaled_idct.cc -o jpeg_scaled_idct && ./jpeg_scaled_idct
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+extern "C" {
+    #define STB_IMAGE_IMPLEMENTATION
+    #include "../stb_image.h"
+}
+
+#include "../jpeg_luma.h"
+#include "jpeg_writer.h"
+
+using namespace std;
+
+typedef vector<unsigned char> Bytes;
+
+struct Bound {
+    int max;
+    double mean_abs;
+    double bias;
+};
+
+int failures = 0;
+
+void check(const char * name, const Bytes & file) {
+    ImageBuffer full;
+    int none = 1;
+    if (!decode_image_luma(full, file.data(), static_cast<int>(file.size()), none)) {
+        printf("FAIL %s: does not decode\n", name);
+        failures++;
+        return;
+    }
+    ImageView f = full.view();
+
+    for (int reduce = 2; reduce <= 8; reduce *= 2) {
+        const Bound bound = reduce == 8 ? Bound{1, 0.25, 0.25} : Bound{32, 2.0, 0.5};
+        ImageBuffer reduced;
+        int applied = reduce;
+        bool decoded = decode_image_luma(reduced, file.data(), static_cast<int>(file.size()), applied);
+        ImageView r = reduced.view();
+        if (!decoded || applied != reduce || r.width != f.width / reduce || r.height != f.height / reduce) {
+            printf("FAIL %s, 1/%d: not decoded at that size\n", name, reduce);
+            failures++;
+            continue;
+        }
+
+        int worst = 0;
+        double total = 0;
+        double total_abs = 0;
+        for (int y = 0; y < r.height; y++) {
+            for (int x = 0; x < r.width; x++) {
+                int sum = 0;
+                for (int j = 0; j < reduce; j++) {
+                    for (int i = 0; i < reduce; i++) {
+                        sum += f.row(y * reduce + j)[x * reduce + i];
+                    }
+                }
+                int error = r.row(y)[x] - sum / (reduce * reduce);
+                worst = max(worst, abs(error));
+                total += error;
+                total_abs += abs(error);
+            }
+        }
+        double cells = static_cast<double>(r.width) * r.height;
+        double bias = total / cells;
+        double mean_abs = total_abs / cells;
+        bool ok = worst <= bound.max && mean_abs <= bound.mean_abs && fabs(bias) <= bound.bias;
+        printf("%s %s, 1/%d: max error %d, mean abs %.3f, bias %+.3f\n", ok ? "ok  " : "FAIL", name, reduce, worst,
+               mean_abs, bias);
+        failures += ok ? 0 : 1;
+    }
+}
+
+unsigned char smooth(int x, int y) {
+    return static_cast<unsigned char>(128 + 100 * sin(x / 9.0) * cos(y / 13.0));
+}
+
+int main() {
+    MappedFile photo;
+    if (photo.open("hello_world.jpg")) {
+        check("hello_world.jpg", Bytes(photo.data(), photo.data() + photo.size()));
+    } else {
+        printf("FAIL hello_world.jpg: run from the repository root\n");
+        failures++;
+    }
+
+    check("smooth gray", JpegWriter::encode({160, 96, 1, 1, 0, 1}, smooth));
+    check("smooth ycbcr 2x2", JpegWriter::encode({160, 96, 3, 2, 0, 1}, smooth));
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+/**
+ * @brief Regression test: a truncated JPEG streams the same plane it decodes to
+ *
+ * When a restart interval ends without an RST marker the decoders stop and
+ * leave the blocks they never reached black. Streaming works a strip of
+ * blocks at a time, and an interval that stopped partway through a strip
+ * used to leave the rest of it holding the previous strip's pixels. Builds
+ * JPEGs whose restart interval (4 MCUs) does not divide a strip, cuts them
+ * at a range of points and checks stream_image_luma against
+ * decode_image_luma row for row, at full size and reduced.
+ *
+ * g++ -O2 -pthread tests/jpeg_stream_truncated.cc -o jpeg_stream_truncated && ./jpeg_stream_truncated
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+extern "C" {
+    #define STB_IMAGE_IMPLEMENTATION
+    #include "../stb_image.h"
+}
+
+#include "../jpeg_luma.h"
+#include "jpeg_writer.h"
+
+using namespace std;
+
+typedef vector<unsigned char> Bytes;
+
+struct PlaneSink {
+    int width = 0;
+    int height = 0;
+    Bytes pixels;
+
+    void start(int x, int y, int) {
+        width = x;
+        height = y;
+    }
+
+    void row(const unsigned char * luma) {
+        pixels.insert(pixels.end(), luma, luma + width);
+    }
+};
+
+int failures = 0;
+
+void check(const char * name, const Bytes & file, int reduce) {
+    PlaneSink sink;
+    bool streamed = stream_image_luma(file.data(), static_cast<int>(file.size()), reduce, sink);
+
+    ImageBuffer plane;
+    int applied = reduce;
+    bool decoded = decode_image_luma(plane, file.data(), static_cast<int>(file.size()), applied);
+    ImageView view = plane.view();
+
+    bool ok = streamed && decoded && sink.width == view.width && sink.height == view.height &&
+              sink.pixels.size() == static_cast<size_t>(view.width) * view.height;
+    int first = -1;
+    for (int y = 0; ok && y < view.height; y++) {
+        if (memcmp(sink.pixels.data() + static_cast<size_t>(y) * view.width, view.row(y), view.width) != 0) {
+            first = y;
+            ok = false;
+        }
+    }
+    printf("%s %s, 1/%d: %dx%d", ok ? "ok  " : "FAIL", name, reduce, view.width, view.height);
+    if (first >= 0) {
+        printf(", first differing row %d", first);
+    }
+    printf("\n");
+    failures += ok ? 0 : 1;
+}
+
+unsigned char pixel(int x, int y) {
+    return static_cast<unsigned char>(((x * 13) ^ (y * 7)) + x * y / 5);
+}
+
+int main() {
+    // 7 blocks or MCUs to a strip, restarts every 4
+    const JpegSpec specs[] = {
+        {56, 48, 1, 1, 4, 2},
+        {56, 48, 3, 1, 4, 2},
+        {112, 64, 3, 2, 4, 2},
+    };
+    const char * names[] = {"gray", "ycbcr 1x1", "ycbcr 2x2"};
+
+    for (int s = 0; s < 3; s++) {
+        Bytes whole = JpegWriter::encode(specs[s], pixel);
+        for (int reduce = 1; reduce <= 8; reduce *= 2) {
+            char name[64];
+            snprintf(name, sizeof(name), "%s, whole", names[s]);
+            check(name, whole, reduce);
+            for (int percent = 30; percent < 100; percent += 7) {
+                size_t keep = whole.size() * percent / 100;
+                snprintf(name, sizeof(name), "%s, cut at %d%%", names[s], percent);
+                check(name, Bytes(whole.begin(), whole.begin() + keep), reduce);
+            }
+        }
+    }
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+/**
+ * @brief Minimal baseline JPEG encoder for building test inputs in memory
+ *
+ * Writes 8-bit grayscale, or YCbCr with flat chroma and Y sampled 1x1 or
+ * 2x2, with an optional restart interval. The Huffman tables are its own
+ * (fixed-length codes over every symbol), which any decoder accepts.
+ */
+
+#ifndef TESTS_JPEG_WRITER_H
+#define TESTS_JPEG_WRITER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+struct JpegSpec {
+    int width;
+    int height;
+    int components;  // 1 or 3
+    int sampling;    // Y blocks per MCU side when components is 3
+    int restart;     // MCUs per restart interval, 0 for none
+    int quant;       // every coefficient's quantizer
+};
+
+class JpegWriter {
+public:
+    typedef std::vector<unsigned char> Bytes;
+
+    template <class Pixel>
+    static Bytes encode(const JpegSpec & spec, Pixel pixel) {
+        JpegWriter w(spec);
+        w.headers();
+        const int sampling = spec.components == 3 ? spec.sampling : 1;
+        const int mcu = 8 * sampling;
+        const int mcus_x = (spec.width + mcu - 1) / mcu;
+        const int mcus_y = (spec.height + mcu - 1) / mcu;
+        int block[64];
+        for (int j = 0; j < mcus_y; j++) {
+            for (int i = 0; i < mcus_x; i++) {
+                int index = j * mcus_x + i;
+                if (spec.restart > 0 && index > 0 && index % spec.restart == 0) {
+                    w.restart(index / spec.restart - 1);
+                }
+                for (int by = 0; by < sampling; by++) {
+                    for (int bx = 0; bx < sampling; bx++) {
+                        int x0 = i * mcu + bx * 8;
+                        int y0 = j * mcu + by * 8;
+                        for (int k = 0; k < 64; k++) {
+                            int x = std::min(x0 + k % 8, spec.width - 1);
+                            int y = std::min(y0 + k / 8, spec.height - 1);
+                            block[k] = pixel(x, y) - 128;
+                        }
+                        w.block(block, 0);
+                    }
+                }
+                if (spec.components == 3) {
+                    std::fill(block, block + 64, 0);
+                    w.block(block, 1);
+                    w.block(block, 2);
+                }
+            }
+        }
+        w.align();
+        w.marker(0xd9);
+        return w.out;
+    }
+
+private:
+    JpegSpec spec;
+    Bytes out;
+    uint32_t acc = 0;
+    int used = 0;
+    int predictor[3] = {0, 0, 0};
+    int zigzag[64];
+    uint16_t ac_code[256];
+
+    explicit JpegWriter(const JpegSpec & spec) : spec(spec) {
+        int k = 0;
+        for (int s = 0; s < 15; s++) {
+            int lo = std::max(0, s - 7);
+            int hi = std::min(s, 7);
+            for (int n = 0; n <= hi - lo; n++) {
+                int row = (s % 2 == 1) ? lo + n : hi - n;
+                zigzag[k++] = row * 8 + (s - row);
+            }
+        }
+        std::vector<unsigned char> symbols = ac_symbols();
+        for (size_t i = 0; i < symbols.size(); i++) {
+            ac_code[symbols[i]] = static_cast<uint16_t>(i);
+        }
+    }
+
+    // EOB, ZRL, then every run/size pair; each gets the 8-bit code of its index
+    static Bytes ac_symbols() {
+        Bytes symbols = {0x00, 0xf0};
+        for (int run = 0; run < 16; run++) {
+            for (int size = 1; size <= 10; size++) {
+                symbols.push_back(static_cast<unsigned char>(run << 4 | size));
+            }
+        }
+        return symbols;
+    }
+
+    void marker(int m) {
+        out.push_back(0xff);
+        out.push_back(static_cast<unsigned char>(m));
+    }
+
+    void segment(int m, const Bytes & body) {
+        marker(m);
+        out.push_back(static_cast<unsigned char>((body.size() + 2) >> 8));
+        out.push_back(static_cast<unsigned char>(body.size() + 2));
+        out.insert(out.end(), body.begin(), body.end());
+    }
+
+    void headers() {
+        marker(0xd8);
+        Bytes quant(65, static_cast<unsigned char>(spec.quant));
+        quant[0] = 0;
+        segment(0xdb, quant);
+
+        Bytes dc = {0x00};
+        for (int len = 1; len <= 16; len++) {
+            dc.push_back(len == 4 ? 12 : 0);
+        }
+        for (int s = 0; s < 12; s++) {
+            dc.push_back(static_cast<unsigned char>(s));
+        }
+        segment(0xc4, dc);
+        Bytes symbols = ac_symbols();
+        Bytes ac = {0x10};
+        for (int len = 1; len <= 16; len++) {
+            ac.push_back(len == 8 ? static_cast<unsigned char>(symbols.size()) : 0);
+        }
+        ac.insert(ac.end(), symbols.begin(), symbols.end());
+        segment(0xc4, ac);
+
+        const int sampling = spec.components == 3 ? spec.sampling : 1;
+        Bytes frame = {8, static_cast<unsigned char>(spec.height >> 8), static_cast<unsigned char>(spec.height),
+                       static_cast<unsigned char>(spec.width >> 8), static_cast<unsigned char>(spec.width),
+                       static_cast<unsigned char>(spec.components)};
+        for (int c = 0; c < spec.components; c++) {
+            int s = c == 0 ? sampling : 1;
+            frame.insert(frame.end(), {static_cast<unsigned char>(c + 1), static_cast<unsigned char>(s << 4 | s), 0});
+        }
+        segment(0xc0, frame);
+        if (spec.restart > 0) {
+            segment(0xdd, {static_cast<unsigned char>(spec.restart >> 8), static_cast<unsigned char>(spec.restart)});
+        }
+        Bytes scan = {static_cast<unsigned char>(spec.components)};
+        for (int c = 0; c < spec.components; c++) {
+            scan.insert(scan.end(), {static_cast<unsigned char>(c + 1), 0x00});
+        }
+        scan.insert(scan.end(), {0, 63, 0});
+        segment(0xda, scan);
+    }
+
+    // MSB first, with a zero stuffed after every 0xff
+    void bits(uint32_t value, int count) {
+        for (int i = count - 1; i >= 0; i--) {
+            acc = acc << 1 | ((value >> i) & 1);
+            if (++used == 8) {
+                out.push_back(static_cast<unsigned char>(acc));
+                if (acc == 0xff) {
+                    out.push_back(0);
+                }
+                acc = 0;
+                used = 0;
+            }
+        }
+    }
+
+    void align() {
+        while (used != 0) {
+            bits(1, 1);
+        }
+    }
+
+    void restart(int n) {
+        align();
+        marker(0xd0 + n % 8);
+        predictor[0] = predictor[1] = predictor[2] = 0;
+    }
+
+    static int category(int v) {
+        int size = 0;
+        for (int m = v < 0 ? -v : v; m != 0; m >>= 1) {
+            size++;
+        }
+        return size;
+    }
+
+    void value(int v, int size) {
+        bits(static_cast<uint32_t>(v < 0 ? v + (1 << size) - 1 : v), size);
+    }
+
+    void block(const int * samples, int component) {
+        const double pi = 3.14159265358979323846;
+        int coeff[64];
+        for (int v = 0; v < 8; v++) {
+            for (int u = 0; u < 8; u++) {
+                double sum = 0;
+                for (int y = 0; y < 8; y++) {
+                    for (int x = 0; x < 8; x++) {
+                        sum += samples[y * 8 + x] * std::cos((2 * x + 1) * u * pi / 16) * std::cos((2 * y + 1) * v * pi / 16);
+                    }
+                }
+                double cu = u == 0 ? std::sqrt(0.5) : 1.0;
+                double cv = v == 0 ? std::sqrt(0.5) : 1.0;
+                coeff[v * 8 + u] = static_cast<int>(std::lround(sum * cu * cv / 4 / spec.quant));
+            }
+        }
+
+        int diff = coeff[0] - predictor[component];
+        predictor[component] = coeff[0];
+        int size = category(diff);
+        bits(static_cast<uint32_t>(size), 4);
+        value(diff, size);
+
+        int run = 0;
+        for (int k = 1; k < 64; k++) {
+            int c = coeff[zigzag[k]];
+            if (c == 0) {
+                run++;
+                continue;
+            }
+            for (; run > 15; run -= 16) {
+                bits(ac_code[0xf0], 8);
+            }
+            size = category(c);
+            bits(ac_code[run << 4 | size], 8);
+            value(c, size);
+            run = 0;
+        }
+        if (run > 0) {
+            bits(ac_code[0x00], 8);
+        }
+    }
+};
+
+#endif
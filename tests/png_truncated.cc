@@ -0,0 +1,168 @@
+/**
+ * @brief Regression test: truncated IDAT data must fail the streaming PNG path
+ *
+ * The streaming inflater pads past the end of its input with zero bits so it
+ * can look ahead; rows decoded out of that padding used to be handed out as
+ * if they were real, so a PNG cut off after 10 of its 40 rows rendered all
+ * 40. Builds small PNGs in memory (fixed-Huffman and stored deflate blocks),
+ * cuts their IDAT short and checks that png_stream_luma, png_decode_luma and
+ * stb_image all reject them while the whole files still decode.
+ *
+ * g++ -O2 tests/png_truncated.cc -o png_truncated && ./png_truncated
+ */
+
+#include <cstdio>
+#include <cstdint>
+#include <vector>
+
+extern "C" {
+    #define STB_IMAGE_IMPLEMENTATION
+    #include "../stb_image.h"
+}
+
+#include "../png_stream.h"
+
+using namespace std;
+
+typedef vector<unsigned char> Bytes;
+
+const int width = 7;
+const int height = 40;
+
+// Deflate bits go out least significant first; Huffman codes most significant first.
+struct BitWriter {
+    Bytes bytes;
+    int used = 8;
+
+    void bits(uint32_t value, int count) {
+        for (int i = 0; i < count; i++) {
+            if (used == 8) {
+                bytes.push_back(0);
+                used = 0;
+            }
+            bytes.back() |= static_cast<unsigned char>(((value >> i) & 1) << used++);
+        }
+    }
+
+    void code(uint32_t value, int count) {
+        for (int i = count - 1; i >= 0; i--) {
+            bits((value >> i) & 1, 1);
+        }
+    }
+};
+
+Bytes rows() {
+    Bytes raw;
+    for (int y = 0; y < height; y++) {
+        raw.push_back(0);
+        for (int x = 0; x < width; x++) {
+            raw.push_back(static_cast<unsigned char>(x * 37 + y * 11));
+        }
+    }
+    return raw;
+}
+
+// zlib stream of one fixed-Huffman block holding every byte as a literal
+Bytes fixed_huffman(const Bytes & raw) {
+    BitWriter out;
+    out.bytes = {0x78, 0x01};
+    out.bits(1, 1);
+    out.bits(1, 2);
+    for (unsigned char c : raw) {
+        if (c < 144) {
+            out.code(0x30 + c, 8);
+        } else {
+            out.code(0x190 + c - 144, 9);
+        }
+    }
+    out.code(0, 7);
+    return out.bytes;
+}
+
+// zlib stream of one stored block
+Bytes stored(const Bytes & raw) {
+    Bytes out = {0x78, 0x01, 0x01};
+    out.push_back(static_cast<unsigned char>(raw.size()));
+    out.push_back(static_cast<unsigned char>(raw.size() >> 8));
+    out.push_back(static_cast<unsigned char>(~raw.size()));
+    out.push_back(static_cast<unsigned char>(~raw.size() >> 8));
+    out.insert(out.end(), raw.begin(), raw.end());
+    return out;
+}
+
+void put_u32(Bytes & out, uint32_t value) {
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        out.push_back(static_cast<unsigned char>(value >> shift));
+    }
+}
+
+void put_chunk(Bytes & png, const char * type, const Bytes & data) {
+    put_u32(png, static_cast<uint32_t>(data.size()));
+    Bytes body(type, type + 4);
+    body.insert(body.end(), data.begin(), data.end());
+    uint32_t crc = 0xffffffff;
+    for (unsigned char c : body) {
+        crc ^= c;
+        for (int k = 0; k < 8; k++) {
+            crc = (crc >> 1) ^ (0xedb88320 & (0 - (crc & 1)));
+        }
+    }
+    png.insert(png.end(), body.begin(), body.end());
+    put_u32(png, ~crc);
+}
+
+// 8-bit grayscale, with the zlib stream cut to its first `keep` bytes
+Bytes png(const Bytes & zlib, size_t keep) {
+    Bytes png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    Bytes header;
+    put_u32(header, width);
+    put_u32(header, height);
+    header.insert(header.end(), {8, 0, 0, 0, 0});
+    put_chunk(png, "IHDR", header);
+    put_chunk(png, "IDAT", Bytes(zlib.begin(), zlib.begin() + keep));
+    put_chunk(png, "IEND", Bytes());
+    return png;
+}
+
+struct CountingSink {
+    int rows = 0;
+    void start(int, int, int) {}
+    void row(const unsigned char *) { rows++; }
+};
+
+int failures = 0;
+
+void check(const char * name, const Bytes & file, bool whole) {
+    CountingSink sink;
+    bool unsupported = false;
+    int streamed = png_stream_luma(file.data(), file.size(), sink, &unsupported);
+
+    int x, y, n;
+    unsigned char * plane = png_decode_luma(file.data(), file.size(), &x, &y, &unsupported);
+    stbi_image_free(plane);
+    unsigned char * decoded = stbi_load_from_memory(file.data(), static_cast<int>(file.size()), &x, &y, &n, 1);
+    stbi_image_free(decoded);
+
+    bool ok = whole ? streamed == 1 && sink.rows == height && plane != nullptr && decoded != nullptr
+                    : streamed == 0 && sink.rows < height && plane == nullptr && decoded == nullptr;
+    printf("%s %s: stream %d with %d rows, stb_image %s\n", ok ? "ok  " : "FAIL", name, streamed, sink.rows,
+           decoded != nullptr ? "decoded" : "rejected");
+    failures += ok ? 0 : 1;
+}
+
+int main() {
+    Bytes raw = rows();
+    const size_t ten_rows = 10 * (width + 1);
+
+    Bytes huffman = fixed_huffman(raw);
+    check("fixed huffman, whole", png(huffman, huffman.size()), true);
+    // 8 or 9 bits a literal, after the 2-byte header and 3 block bits
+    check("fixed huffman, 10 rows", png(huffman, 2 + ten_rows), false);
+    check("fixed huffman, last two bytes cut", png(huffman, huffman.size() - 2), false);
+
+    Bytes block = stored(raw);
+    check("stored, whole", png(block, block.size()), true);
+    check("stored, 10 rows", png(block, 7 + ten_rows), false);
+
+    return failures == 0 ? 0 : 1;
+}
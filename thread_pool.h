@@ -0,0 +1,87 @@
+/**
+ * @brief Small persistent thread pool
+ *
+ * Workers are started once and sleep on a queue between jobs, so rendering
+ * many images (or one image many times) does not pay for thread creation.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+public:
+    // 0 means one worker per hardware thread.
+    explicit ThreadPool(unsigned threads = 0) : stopping_(false) {
+        if (threads == 0) {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (threads == 0) {
+            threads = 1;
+        }
+        for (unsigned i = 0; i < threads; i++) {
+            workers_.emplace_back([this] { work(); });
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const { return static_cast<unsigned>(workers_.size()); }
+
+    template <class F>
+    std::future<void> submit(F job) {
+        auto task = std::make_shared<std::packaged_task<void()>>(std::move(job));
+        std::future<void> done = task->get_future();
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.emplace([task] { (*task)(); });
+        }
+        wake_.notify_one();
+        return done;
+    }
+
+private:
+    void work() {
+        for (;;) {
+            std::function<void()> job;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+                if (jobs_.empty()) {
+                    return;
+                }
+                job = std::move(jobs_.front());
+                jobs_.pop();
+            }
+            job();
+        }
+    }
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> jobs_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_;
+};
+
+#endif